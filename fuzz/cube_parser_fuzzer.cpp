@@ -0,0 +1,34 @@
+/*
+ * CubeIsoFinder
+ * File: cube_parser_fuzzer.cpp
+ *
+ * Description:
+ *   libFuzzer target for the text cube parser. Any input must either parse or raise a
+ *   runtime_error; crashes, other exceptions, leaks and undefined behaviour are findings.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "cube_parser.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    const char *text = reinterpret_cast<const char *>(data);
+    for (bool allowTruncated : {false, true}) {
+        try {
+            CubeData cube = parseCubeData(text, size, allowTruncated);
+            // Exercise the header-derived quantities used by every analysis.
+            computeVoxelVolume(cube.header);
+            detectAngstrom(cube.header);
+        }
+        catch (const std::runtime_error &) {
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * CubeIsoFinder
+ * File: replay_main.cpp
+ *
+ * Description:
+ *   Runs the fuzz target on the files given on the command line (or on all files in the
+ *   given directories). Used instead of libFuzzer when the compiler does not provide it,
+ *   e.g. to replay a corpus or a crash input under the sanitizers.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+namespace {
+
+void runFile(const std::filesystem::path &path) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    size_t inputs = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::filesystem::path path(argv[i]);
+        if (std::filesystem::is_directory(path)) {
+            for (const auto &entry : std::filesystem::directory_iterator(path))
+                if (entry.is_regular_file()) {
+                    runFile(entry.path());
+                    ++inputs;
+                }
+        }
+        else {
+            runFile(path);
+            ++inputs;
+        }
+    }
+    std::cout << "Ran " << inputs << " inputs.\n";
+    return 0;
+}
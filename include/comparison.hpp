@@ -0,0 +1,43 @@
+/*
+ * CubeIsoFinder
+ * File: comparison.hpp
+ *
+ * Description:
+ *   Declares the comparison of several cubes on a common grid (e.g. one orbital computed
+ *   with different functionals or basis sets).
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef COMPARISON_HPP
+#define COMPARISON_HPP
+
+#include "cube_parser.hpp"
+#include <string>
+#include <vector>
+
+// ----- Multi-File Comparison -----
+//
+// All files must share the grid (dimensions, origin and axis vectors) and the data type;
+// this is checked once against the first file. The files are loaded one after another,
+// each with the parallel parser. For a common percentage, each file's isovalue is
+// computed, and then for every file the percentages it encloses at all files' isovalues
+// in one pass over its grid.
+struct CubeComparison {
+    CubeHeader header;                      // Header of the first file.
+    std::vector<double> isovalues;          // isovalues[i]: isovalue of file i.
+    std::vector<double> totals;             // totals[i]: integrated quantity of file i.
+    std::vector<std::vector<double>> cross; // cross[i][j]: percentage of file j enclosed by isovalues[i].
+};
+
+// True if both grids have the same dimensions, origin and axis vectors (within 1e-6).
+bool sameGrid(const CubeHeader &a, const CubeHeader &b);
+
+CubeComparison compareCubes(const std::vector<std::string> &filenames, double percent, bool positive,
+                            bool interpolate, bool allowTruncated);
+
+#endif // COMPARISON_HPP
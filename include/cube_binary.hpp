@@ -0,0 +1,66 @@
+/*
+ * CubeIsoFinder
+ * File: cube_binary.hpp
+ *
+ * Description:
+ *   Declares reading and writing of the compact binary cube format (.cubeb),
+ *   which stores the grid in independently compressed slabs with a chunk index.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef CUBE_BINARY_HPP
+#define CUBE_BINARY_HPP
+
+#include "cube_parser.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ----- Binary Cube Format -----
+//
+// A .cubeb file contains, in little-endian byte order:
+//   - the 8-byte magic "CUBEB01\n",
+//   - the cube header (comments, calculation type, origin, axis vectors, atom block),
+//   - a chunk index,
+//   - the compressed chunks.
+// The grid is split into slabs of consecutive planes along the first (slowest-varying)
+// axis, so each chunk is a contiguous range of CubeData::values. Each chunk is
+// compressed on its own (XOR delta of neighbouring values, byte shuffle, zero-run
+// encoding) and can therefore be decompressed in parallel or selectively.
+
+// CubeBinaryChunk describes one compressed slab.
+struct CubeBinaryChunk {
+    uint64_t offset;          // Byte offset of the compressed data in the file.
+    uint64_t compressedBytes; // Size of the compressed data.
+    uint32_t firstPlane;      // First plane (index along the first axis) in the slab.
+    uint32_t planeCount;      // Number of planes in the slab.
+};
+
+// CubeBinaryInfo holds the header and chunk index of a .cubeb file.
+struct CubeBinaryInfo {
+    CubeHeader header;
+    uint32_t planesPerChunk;
+    std::vector<CubeBinaryChunk> chunks;
+};
+
+// Returns true if the file starts with the .cubeb magic.
+bool isCubeBinaryFile(const std::string &filename);
+
+// Conversion functions.
+// planesPerChunk controls the slab thickness; 0 selects a thickness of about 1M values per chunk.
+void writeCubeBinary(const CubeData &cube, const std::string &filename, uint32_t planesPerChunk = 0);
+CubeData readCubeBinary(const std::string &filename);
+
+// Selective access: read only the header/index, a range of planes, or a sub-box.
+// The sub-box is given by inclusive lower and exclusive upper voxel indices per axis;
+// the result holds the values of the box in the same x-major order as CubeData::values.
+CubeBinaryInfo readCubeBinaryInfo(const std::string &filename);
+std::vector<double> readCubeBinarySlab(const std::string &filename, int firstPlane, int planeCount);
+std::vector<double> readCubeBinaryBox(const std::string &filename, const int lo[3], const int hi[3]);
+
+#endif // CUBE_BINARY_HPP
@@ -0,0 +1,61 @@
+/*
+ * CubeIsoFinder
+ * File: cube_formats.hpp
+ *
+ * Description:
+ *   Declares the registry of cube file producers (ORCA, Q-Chem, Gaussian, Psi4,
+ *   Multiwfn, CP2K, ...) with their header conventions, unit rules and data layouts.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef CUBE_FORMATS_HPP
+#define CUBE_FORMATS_HPP
+
+#include "cube_parser.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// ----- Cube Producer Detection -----
+//
+// A CubeFormatDetector describes the cube files of one producer. It is selected from the
+// two comment lines when the header is parsed, and its name becomes CubeHeader::calcType.
+//   - matches: recognises the producer from the comment lines (empty: only found by name,
+//     e.g. for the formats read by other readers).
+//   - readExtraHeader: consumes the lines between the atom block and the data, starting at
+//     pos, and stores them in CubeHeader::extraLine. The common convention (Gaussian) is
+//     a line with the number of orbitals and their indices when numAtoms is negative;
+//     ORCA always writes one extra line.
+//   - isOrbital: classifies the data once the header has been read.
+//   - units: Bohr if the producer always writes bohr; otherwise the length heuristic of
+//     detectAngstrom applies. A negative voxel count marks Angstrom for every producer.
+// The data layout is not part of the detector: the fixed-width layout of the data block
+// is taken from the data itself (see cube_text_layout.hpp) for every producer.
+
+enum class LengthUnitRule { Bohr, Heuristic };
+
+struct CubeFormatDetector {
+    std::string name;
+    std::function<bool(const std::string &comment1, const std::string &comment2)> matches;
+    std::function<void(const char *data, size_t size, size_t &pos, CubeHeader &header)> readExtraHeader;
+    std::function<bool(const CubeHeader &header)> isOrbital;
+    LengthUnitRule units = LengthUnitRule::Heuristic;
+};
+
+// Detectors are tried in registration order, with registered ones before the built-in
+// ones; "Generic" matches everything and comes last. Registration is not thread-safe and
+// should happen at startup.
+void registerCubeFormatDetector(CubeFormatDetector detector);
+const CubeFormatDetector &detectCubeFormat(const std::string &comment1, const std::string &comment2);
+const CubeFormatDetector *findCubeFormat(const std::string &name);
+
+// The Gaussian conventions shared by most producers, for use in custom detectors.
+void readOrbitalIndexLines(const char *data, size_t size, size_t &pos, CubeHeader &header);
+bool isOrbitalByKeywords(const CubeHeader &header);
+
+#endif // CUBE_FORMATS_HPP
@@ -15,16 +15,25 @@
 #ifndef CUBE_PARSER_HPP
 #define CUBE_PARSER_HPP
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 // Structure representing the header information of a cube file.
 // ----- Cube File Parsing Structures -----
+//
+// CubeAtom holds one line of the atom block: atomic number, nuclear charge and position.
+struct CubeAtom {
+    int atomicNumber;
+    double charge;
+    double position[3];
+};
+
 //
 // CubeHeader holds information about the cube file. It contains the
 // first two comment lines, number of atoms, the origin, grid dimensions,
 // axis vectors (each with the voxel count and 3 vector components),
-// the calculation type (e.g., "Q-Chem", "ORCA", "Generic"),
+// the producer (see cube_formats.hpp),
 // and a flag indicating whether the data are orbital (true) or density (false).
 struct CubeHeader {
     std::string comment1;
@@ -32,9 +41,11 @@ struct CubeHeader {
     int numAtoms;
     double origin[3];
     int dims[3];              // Number of voxels in x, y, and z directions.
-    double axisVectors[3][4]; // Each row: [n, ax, ay, az] for the axis (n is the voxel count).
-    std::string calcType;     // "Q-Chem", "ORCA", or "Generic".
+    double axisVectors[3][4]; // Each row: [n, ax, ay, az] for the axis (n is the voxel count, negative for Angstrom).
+    std::string calcType;     // Producer: "ORCA", "Q-Chem", "Gaussian", ..., or "Generic".
     bool isOrbital;           // True if orbital data; false if density data.
+    std::vector<CubeAtom> atoms; // Atom block, in file order.
+    std::string extraLine;    // Lines between the atom block and the data (ORCA line, orbital indices).
 };
 
 // CubeData holds a CubeHeader and a flat vector of doubles that contains
@@ -44,12 +55,54 @@ struct CubeData {
     std::vector<double> values;
 };
 
+// ----- Integrity Checking Structures -----
+//
+// CubeLineAnomaly records a data line whose number of values differs from the
+// standard cube layout (6 values per line, wrapping at the end of each z-row).
+struct CubeLineAnomaly {
+    size_t line;   // 1-based line number in the file.
+    size_t offset; // Byte offset of the start of the line.
+    int expected;  // Number of values the standard layout predicts.
+    int found;     // Number of values actually present.
+};
+
+// CubeValidationReport summarizes a structural check of a cube file.
+// The expected data size is predicted from the fixed-width layout of the first
+// data row, so truncation is visible before the data block is scanned.
+struct CubeValidationReport {
+    CubeHeader header;
+    size_t expectedPoints;    // dims[0] * dims[1] * dims[2].
+    size_t pointsFound;       // Well-formed values before the first error.
+    size_t dataOffset;        // Byte offset at which the volumetric data starts.
+    size_t expectedDataBytes; // Predicted data size (0 if the layout is not fixed-width).
+    size_t actualDataBytes;   // Bytes between dataOffset and the end of the file.
+    bool truncated;           // Fewer values than expected.
+    bool malformed;           // A token that is not a number was found.
+    size_t errorOffset;       // Byte offset of the malformed token or of the end of the valid data.
+    size_t anomalyCount;      // Total number of layout anomalies.
+    std::vector<CubeLineAnomaly> lineAnomalies; // The first few anomalies, in file order.
+};
+
 // Helper function declarations.
 std::string trim(const std::string &s);
 bool icontains(const std::string &data, const std::string &substr);
 
 // Cube file parsing functions.
-CubeData readCubeFile(const std::string &filename);
+// parseCubeHeader reads the header from an in-memory cube file and sets dataOffset
+// to the byte offset of the first volumetric value line.
+// scanValues appends up to maxCount numbers from [p, end) to out, stopping at the first
+// token that is not a number, and advances p; it is shared by all text-format readers.
+// If allowTruncated is true, readCubeFile keeps the valid prefix of a truncated or
+// corrupted data block instead of throwing. parseCubeData does the same for a file
+// already in memory; malformed input of any kind raises a runtime_error.
+CubeHeader parseCubeHeader(const char *data, size_t size, size_t &dataOffset);
+size_t scanValues(const char *&p, const char *end, std::vector<double> &out, size_t maxCount);
+CubeData readCubeFile(const std::string &filename, bool allowTruncated = false);
+CubeData parseCubeData(const char *data, size_t size, bool allowTruncated = false);
+CubeValidationReport validateCubeFile(const std::string &filename);
+
+// Write a CubeData structure as a text cube file (6 values per line, wrapping at each z-row).
+void writeCubeFile(const CubeData &cube, const std::string &filename);
 double computeVoxelVolume(const CubeHeader &header);
 
 // Unit detection and conversion functions.
@@ -58,12 +111,92 @@ double convertDensity(double nativeDensity, bool nativeIsAngstrom);
 double convertOrbital(double nativeOrbital, bool nativeIsAngstrom);
 
 // Integration functions for density data.
-double computeIsovalueFromPercentage_Density(const std::vector<double> &values, double percent, bool positive);
-double computePercentageFromIsovalue_Density(const std::vector<double> &values, double isovalue, bool positive);
+// With interpolate, the isovalue is interpolated between the two grid levels bracketing
+// the target fraction, and the percentage is interpolated between the two grid levels
+// bracketing the isovalue, which gives continuous results on coarse grids.
+double computeIsovalueFromPercentage_Density(const std::vector<double> &values, double percent, bool positive,
+                                             bool interpolate = false);
+double computePercentageFromIsovalue_Density(const std::vector<double> &values, double isovalue, bool positive,
+                                             bool interpolate = false);
 
 // Integration functions for orbital data.
-double computeIsovalueFromPercentage_Orbital(const std::vector<double> &values, double percent, bool positive);
-double computePercentageFromIsovalue_Orbital(const std::vector<double> &values, double isovalue, bool positive);
+// With interpolate, the amplitude is interpolated in the same way.
+double computeIsovalueFromPercentage_Orbital(const std::vector<double> &values, double percent, bool positive,
+                                             bool interpolate = false);
+double computePercentageFromIsovalue_Orbital(const std::vector<double> &values, double isovalue, bool positive,
+                                             bool interpolate = false);
+
+// Percentages enclosed by several isovalues, in one pass over the grid: each point is
+// binned by the number of thresholds it reaches, and suffix sums of the bins give the
+// enclosed mass per threshold. Same selection as the functions above (orbital: v^2).
+std::vector<double> computePercentagesFromIsovalues(const std::vector<double> &values,
+                                                    const std::vector<double> &isovalues, bool orbital,
+                                                    bool positive);
+// ----- Sign-Resolved Orbital Analysis -----
+//
+// OrbitalPhase holds the result for one phase of an orbital (positive, negative) or for
+// both phases combined. Percentages refer to the orbital density psi^2.
+struct OrbitalPhase {
+    double isovalue;                // Amplitude enclosing the requested percentage of this phase.
+    double enclosedPercent;         // Percentage of this phase enclosed by isovalue.
+    double phasePercent;            // Share of this phase in the total orbital density.
+    double combinedEnclosedPercent; // Percentage of this phase enclosed by the combined isovalue.
+};
+
+struct OrbitalPhaseReport {
+    OrbitalPhase positive;
+    OrbitalPhase negative;
+    OrbitalPhase combined;
+};
+
+// Compute per-phase and combined results with one sort of a single partitioned buffer.
+// The combined isovalue equals computeIsovalueFromPercentage_Orbital.
+OrbitalPhaseReport computeOrbitalPhasesFromPercentage(const std::vector<double> &values, double percent,
+                                                      bool interpolate = false);
+// Compute per-phase and combined enclosed percentages for one isovalue.
+OrbitalPhaseReport computeOrbitalPhasesFromIsovalue(const std::vector<double> &values, double isovalue,
+                                                    bool interpolate = false);
+
+// ----- Spin Density Analysis -----
+//
+// For spin densities both signs are physical: the alpha-excess (positive) and beta-excess
+// (negative) regions. SpinExcess holds the result for one sign; its percentages refer to
+// that sign's own total, so both regions are reported at matched percentages. Integrals
+// are plain sums of grid values (multiply by the voxel volume for the integrated spin).
+struct SpinExcess {
+    double isovalue;        // Isovalue enclosing the requested percentage (negative for beta).
+    double enclosedPercent; // Percentage of this sign's spin enclosed by the isovalue.
+    double integral;        // Sum of the values of this sign.
+};
+
+struct SpinDensityReport {
+    SpinExcess alpha;
+    SpinExcess beta;
+    double net;      // Sum of all values.
+    double absolute; // Sum of all |values|.
+};
+
+// Both signed isovalues from one sign-partitioned copy of the grid, each sign sorted in
+// place. The isovalues equal computeIsovalueFromPercentage_Density for either sign.
+SpinDensityReport computeSpinDensityFromPercentage(const std::vector<double> &values, double percent,
+                                                   bool interpolate = false);
+// Percentages of both signs enclosed by +|isovalue| and -|isovalue|.
+SpinDensityReport computeSpinDensityFromIsovalue(const std::vector<double> &values, double isovalue,
+                                                 bool interpolate = false);
+
+// ----- Parse Throughput -----
+//
+// Times parseCubeData on a memory-mapped text cube: one untimed run faults the file into
+// memory, then the best of the given number of runs is reported, so the figure reflects
+// the parser rather than the disk.
+struct ParseBenchmark {
+    size_t bytes;              // File size.
+    size_t values;             // Number of values parsed.
+    double bestSeconds;
+    double megabytesPerSecond; // bytes / bestSeconds / 1e6.
+};
+
+ParseBenchmark benchmarkCubeParse(const std::string &filename, int repetitions = 5);
 
 #endif // CUBE_PARSER_HPP
 
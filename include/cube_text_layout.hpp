@@ -0,0 +1,127 @@
+/*
+ * CubeIsoFinder
+ * File: cube_text_layout.hpp
+ *
+ * Description:
+ *   Declares the fixed-width layout of text cube data blocks, which gives the byte
+ *   offset of every value, row-parallel parsing, and random access to values, slices
+ *   and lines of text cubes.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef CUBE_TEXT_LAYOUT_HPP
+#define CUBE_TEXT_LAYOUT_HPP
+
+#include "cube_parser.hpp"
+#include "mapped_file.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ----- Fixed-Width Layout -----
+//
+// Cube writers print every value with the same format, 6 per line, and start a new line
+// at the end of each z-row. Every z-row ("row" below, the values with the same x and y)
+// then occupies the same number of bytes, and the position of value i follows from i:
+//
+//   offset(i) = dataOffset + row * rowBytes + z * fieldWidth + (z / 6) * newlineBytes
+//
+// with row = i / nz and z = i % nz. The field width and line terminator are taken from
+// the first data line. probeCubeTextLayout accepts the layout if the data block has
+// exactly the predicted size (trailing whitespace aside) and the first layoutProbeRows
+// rows and the last row parse at the predicted offsets.
+//
+// A field must start with a space or a sign and consist of one complete number, so a
+// field boundary that cuts a token is detected. Rows are checked again as they are
+// parsed; a deviating row makes parseCubeTextRows return false, and the callers fall
+// back to the free-format scan.
+struct CubeTextLayout {
+    size_t dataOffset = 0;
+    size_t fieldWidth = 0;    // Characters per value.
+    size_t newlineBytes = 1;  // 1 for "\n", 2 for "\r\n".
+    size_t valuesPerLine = 6;
+    size_t rowLength = 0;     // Values per row (dims[2]).
+    size_t rows = 0;          // dims[0] * dims[1].
+    size_t rowBytes = 0;      // Bytes per row, including the line terminators.
+
+    size_t rowOffset(size_t row) const { return dataOffset + row * rowBytes; }
+    size_t valueOffset(size_t index) const {
+        const size_t z = index % rowLength;
+        return rowOffset(index / rowLength) + z * fieldWidth + (z / valuesPerLine) * newlineBytes;
+    }
+};
+
+const size_t layoutProbeRows = 4;
+
+bool probeCubeTextLayout(const char *data, size_t size, const CubeHeader &header, size_t dataOffset,
+                         CubeTextLayout &layout);
+
+// Parse one field of the given width. Returns false unless it holds exactly one number.
+bool parseFixedWidthField(const char *field, size_t width, double &value);
+
+// Parse the rows [firstRow, endRow) into out (rowLength values per row). Returns false at
+// the first field or line terminator that does not match the layout.
+bool parseCubeTextRows(const char *data, const CubeTextLayout &layout, size_t firstRow, size_t endRow,
+                       double *out);
+
+// Parse all rows into out in parallel, in blocks of equal numbers of rows. Returns false
+// (with out in an unspecified state) if any row does not match the layout.
+bool parseCubeTextParallel(const char *data, const CubeTextLayout &layout, std::vector<double> &out);
+
+// ----- Random Access -----
+//
+// CubeTextFile maps a text cube and reads single values or rows without parsing the data
+// before them. With a fixed-width layout the offsets are computed. Otherwise a row index
+// (the byte offset of the first value of every row) is built on first use by one lexical
+// pass over the data block; with a cache directory it is stored there under the content
+// hash of the file and reused by later runs. Throws a runtime_error if a requested value
+// is out of range or malformed.
+class CubeTextFile {
+public:
+    explicit CubeTextFile(const std::string &filename, const std::string &cacheDirectory = "");
+
+    const CubeHeader &header() const { return header_; }
+    bool fixedLayout() const { return fixed_; }
+    const CubeTextLayout &layout() const { return layout_; } // Only valid with a fixed layout.
+
+    double value(size_t index) const;
+    double value(int x, int y, int z) const;
+    void readRows(size_t firstRow, size_t count, double *out) const;
+
+private:
+    const std::vector<uint64_t> &rowOffsets() const;
+
+    std::string filename_;
+    std::string cacheDirectory_;
+    MappedFile file_;
+    CubeHeader header_;
+    size_t dataOffset_ = 0;
+    size_t rowLength_ = 0;
+    size_t rows_ = 0;
+    CubeTextLayout layout_;
+    bool fixed_ = false;
+    mutable std::vector<uint64_t> rowOffsets_; // Built on first use.
+};
+
+// Byte offsets of the first value of each complete row, found by a lexical scan.
+std::vector<uint64_t> buildCubeRowIndex(const char *data, size_t size, size_t dataOffset, size_t rowLength);
+
+// ----- Slices and Lines -----
+//
+// extractSlice returns the plane with index k along axis (0 = x, 1 = y, 2 = z) as a
+// matrix over the two other axes, in axis order with the second one fastest. extractLine
+// returns the values along axis through the point whose other two indices are a and b,
+// in axis order. Only the rows that contain the requested points are parsed. The
+// CubeData overloads serve the formats that are loaded as a whole (.cubeb, CHGCAR, XSF).
+std::vector<double> extractSlice(const CubeTextFile &file, int axis, int k);
+std::vector<double> extractLine(const CubeTextFile &file, int axis, int a, int b);
+std::vector<double> extractSlice(const CubeData &cube, int axis, int k);
+std::vector<double> extractLine(const CubeData &cube, int axis, int a, int b);
+
+#endif // CUBE_TEXT_LAYOUT_HPP
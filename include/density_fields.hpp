@@ -0,0 +1,54 @@
+/*
+ * CubeIsoFinder
+ * File: density_fields.hpp
+ *
+ * Description:
+ *   Declares finite-difference derived fields of the density: gradient, Laplacian
+ *   and reduced density gradient (as used in NCI analysis).
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef DENSITY_FIELDS_HPP
+#define DENSITY_FIELDS_HPP
+
+#include "cube_parser.hpp"
+#include <vector>
+
+// ----- Derived Density Fields -----
+//
+// Derivatives are taken with second-order central differences along the grid axes and
+// transformed to Cartesian coordinates with the inverse of the step matrix formed by
+// axisVectors, so non-orthogonal grids are handled (the Laplacian then includes the mixed
+// derivative terms). Boundary points use one-sided differences, or wrap around when the
+// grid is periodic. All fields are in the native units of the grid.
+//
+// The reduced density gradient is s = |grad rho| / (2 (3 pi^2)^(1/3) rho^(4/3)); it is
+// set to +infinity where rho <= 0.
+//
+// Each field is a full grid of doubles, so only the selected fields are stored; the
+// others are left empty (the Laplacian is then not computed at all).
+struct DensityFieldSelection {
+    bool gradient = false;
+    bool laplacian = false;
+    bool reducedGradient = false;
+};
+
+struct DensityFields {
+    std::vector<double> gradient[3]; // Cartesian components of grad rho.
+    std::vector<double> laplacian;
+    std::vector<double> reducedGradient;
+};
+
+DensityFields computeDensityFields(const CubeData &cube, bool periodic, const DensityFieldSelection &selection);
+
+// Copy of values with every point where s >= maxReducedGradient set to zero, so the
+// integration functions see only the low-gradient (NCI) region.
+std::vector<double> maskByReducedGradient(const std::vector<double> &values, const DensityFields &fields,
+                                          double maxReducedGradient);
+
+#endif // DENSITY_FIELDS_HPP
@@ -0,0 +1,103 @@
+/*
+ * CubeIsoFinder
+ * File: distributed.hpp
+ *
+ * Description:
+ *   Declares the analysis of a single cube whose grid is split into slabs held by
+ *   different processes, which exchange only small reductions.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "cube_parser.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ----- Process Groups -----
+//
+// A ProcessGroup connects the processes that share one analysis. allGather is the only
+// communication primitive: every process contributes the same number of values and
+// receives the contributions of all processes in rank order. Reductions are formed from
+// it in rank order, so every process computes bit-identical results. If one process
+// fails, it calls abort() so that the others do not wait for it forever.
+class ProcessGroup {
+public:
+    virtual ~ProcessGroup() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+    virtual std::vector<double> allGather(const std::vector<double> &local) = 0;
+    virtual void abort() {}
+
+    // Contributions of different sizes, concatenated in rank order.
+    std::vector<double> allGatherVariable(const std::vector<double> &local);
+
+    // Element-wise sum, minimum and maximum over all processes.
+    std::vector<double> sum(const std::vector<double> &local);
+    std::vector<double> min(const std::vector<double> &local);
+    std::vector<double> max(const std::vector<double> &local);
+};
+
+// Only available when built with CUBEISOFINDER_MPI=ON; calls MPI_Init, and MPI_Finalize
+// when the group is destroyed. abort() calls MPI_Abort.
+std::unique_ptr<ProcessGroup> createMpiProcessGroup(int &argc, char **&argv);
+
+// Runs body in the given number of local processes: the calling process is rank 0 and
+// forks the others, which exchange data through shared memory and exit when body returns.
+// Returns the largest exit status of all processes. Must be called before any worker
+// threads are started.
+int runLocalProcessGroup(int processes, const std::function<int(ProcessGroup &)> &body);
+
+// ----- Grid Slabs -----
+//
+// Process r of p holds the x-planes [r nx / p, (r + 1) nx / p), i.e. a contiguous range of
+// CubeData::values. A .cubeb file is read selectively; a text cube is streamed and only
+// the values of the slab are kept, so no process ever holds the whole grid. CHGCAR and
+// XSF files are converted on load, so each process loads them whole and keeps its slab.
+struct GridSlab {
+    CubeHeader header;
+    size_t firstIndex;          // Grid index of values[0].
+    std::vector<double> values;
+};
+
+GridSlab loadGridSlab(const std::string &filename, int part, int parts, bool allowTruncated = false);
+
+// ----- Distributed Threshold Search -----
+//
+// Same selection and threshold contract as the single-process integration functions: the
+// isovalue is the value of the first point in mass order at which the enclosed quantity
+// reaches the target. Grid values are mapped to positive keys in mass order, and the key
+// range is narrowed with a distributed histogram: every process bins its slab into
+// histogramBins bins of equal width in the bit pattern of the key (so the bins follow the
+// dynamic range of the data), the bin counts and sums are added in rank order, and the
+// search continues in the bin where the target is reached. Once that bin holds at most
+// candidateLimit points, their values are gathered and the crossing is located exactly, as
+// in the single-process search. Each round exchanges 2 histogramBins values per process,
+// and a few rounds suffice. The sums are not formed in the global sort order of the
+// single-process search, so the isovalue matches it except when the target lies within
+// rounding error of a level boundary (e.g. 100%). Interpolation is not supported.
+const size_t histogramBins = 4096;
+const size_t candidateLimit = 65536;
+
+struct DistributedResult {
+    size_t points;     // Number of grid points in all slabs.
+    double total;      // Integrated quantity, not scaled by the voxel volume.
+    double isovalue;   // Native isovalue (the input value for -v).
+    double percentage; // Percentage enclosed by the isovalue.
+};
+
+DistributedResult distributedIsovalueFromPercentage(const GridSlab &slab, ProcessGroup &group, double percent,
+                                                    bool positive);
+DistributedResult distributedPercentageFromIsovalue(const GridSlab &slab, ProcessGroup &group, double isovalue,
+                                                    bool positive);
+
+#endif // DISTRIBUTED_HPP
@@ -0,0 +1,54 @@
+/*
+ * CubeIsoFinder
+ * File: grid_layout.hpp
+ *
+ * Description:
+ *   Declares the grid view used by neighbourhood (stencil) operations and a benchmark
+ *   that compares it with a bricked layout.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef GRID_LAYOUT_HPP
+#define GRID_LAYOUT_HPP
+
+#include <cstddef>
+#include <vector>
+
+// ----- Grid Layouts -----
+//
+// In the flat layout a step along x jumps dims[1] * dims[2] values, so stencils touch
+// three far-apart memory regions per point. Neighbourhood algorithms (the derived density
+// fields) are written against the at(x, y, z) accessor of LinearGrid.
+
+// LinearGrid is a non-owning view of CubeData::values.
+struct LinearGrid {
+    const double *data;
+    int dims[3];
+
+    double at(int x, int y, int z) const {
+        return data[(static_cast<size_t>(x) * dims[1] + y) * dims[2] + z];
+    }
+};
+
+// ----- Stencil Benchmark -----
+//
+// StencilBenchmark reports the throughput of a 7-point Laplacian-type stencil applied to
+// every interior voxel of the flat grid and of a copy stored as 8 x 8 x 8 bricks of 512
+// contiguous values (4 KiB), visited brick by brick. The bricked layout exists only for
+// this comparison: on the grids measured so far it is slower than the flat layout, whose
+// z-rows the hardware prefetcher already streams, so the analysis does not use it.
+struct StencilBenchmark {
+    double linearMVoxelsPerSecond;
+    double brickedMVoxelsPerSecond;
+    double conversionSeconds; // Time to build the bricked copy.
+    double checksumDifference; // |sum(linear) - sum(bricked)|; should be ~0.
+};
+
+StencilBenchmark benchmarkStencilLayouts(const std::vector<double> &values, const int dims[3], int repetitions = 3);
+
+#endif // GRID_LAYOUT_HPP
@@ -0,0 +1,45 @@
+/*
+ * CubeIsoFinder
+ * File: mapped_file.hpp
+ *
+ * Description:
+ *   Declares a read-only memory-mapped view of a file used by the fast cube parser.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// MappedFile exposes the bytes of a file as a contiguous read-only range.
+// On POSIX systems the file is memory-mapped; elsewhere it is read into a buffer.
+// The mapping is released when the object is destroyed.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    const char *begin() const { return data_; }
+    const char *end() const { return data_ + size_; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<char> buffer_; // Fallback storage when mmap is unavailable.
+};
+
+#endif // MAPPED_FILE_HPP
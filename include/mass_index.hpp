@@ -0,0 +1,85 @@
+/*
+ * CubeIsoFinder
+ * File: mass_index.hpp
+ *
+ * Description:
+ *   Declares the cumulative-mass index: a small file holding the sorted mass curve of a
+ *   cube, from which -p/-v queries are answered without parsing or sorting the grid.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef MASS_INDEX_HPP
+#define MASS_INDEX_HPP
+
+#include "cube_parser.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ----- Cumulative-Mass Index -----
+//
+// A mass curve is the grid in mass order, as sorted by the integration functions:
+// positive density values in decreasing order, negative density values in increasing
+// order, or orbital values by decreasing psi^2 (positive before negative within a level).
+// The curve is cut into knots of knotSize consecutive points, where knotSize is the
+// smallest power of two of at least minKnotSize that gives at most maxKnots knots.
+// Cumulative masses are formed exactly as in findThresholdCrossing: block sums of
+// reductionBlock points plus a running sum within the block. Each knot stores the block
+// prefix and running sum before its first point, its first and last value, how many
+// points equal to its first value it holds, and the value the integration functions
+// report for the level of its first point (for orbitals, the positive amplitude if the
+// level holds both signs).
+//
+// A query locates the knot containing the threshold by binary search. If the knot spans
+// a single level the answer is exact; otherwise it is bracketed by the knot and estimated
+// by linear interpolation. Refinement scans the grid once for the values in the knot's
+// range and sorts only those, which reproduces the exact result of the full computation.
+enum class MassCurve { Positive = 0, Negative = 1, Orbital = 2 };
+
+struct MassIndexCurve {
+    size_t count = 0;    // Number of points on the curve.
+    double total = 0.0;  // Total mass.
+    size_t knotSize = 0; // Points per knot (the last knot may be shorter).
+    std::vector<double> blockPrefix;   // Sum of the complete blocks before the knot start.
+    std::vector<double> runningBefore; // Sum of the points of the start block before the knot.
+    std::vector<double> first;
+    std::vector<double> last;
+    std::vector<uint64_t> headTies;
+    std::vector<double> levelValue;
+};
+
+struct MassIndex {
+    uint64_t contentHash = 0; // hashFile of the indexed cube.
+    CubeHeader header;        // Header of the cube, without the atom block.
+    MassIndexCurve curves[3]; // Indexed by MassCurve.
+};
+
+const size_t maxKnots = 65536;
+const size_t minKnotSize = 64;
+
+MassIndex buildMassIndex(const CubeData &cube, uint64_t contentHash);
+void writeMassIndex(const MassIndex &index, const std::string &filename);
+MassIndex readMassIndex(const std::string &filename);
+
+// IndexAnswer is an isovalue (for -p) or a percentage (for -v). If exact is false, the
+// answer is an estimate and the true value lies in [lower, upper]; for orbital isovalues
+// the estimate and its bounds refer to the amplitude magnitude.
+struct IndexAnswer {
+    double value;
+    double lower;
+    double upper;
+    bool exact;
+};
+
+// If values (the grid of the indexed cube) is given, an inexact answer is refined.
+IndexAnswer isovalueFromIndex(const MassIndex &index, MassCurve curve, double percent,
+                              const std::vector<double> *values = nullptr);
+IndexAnswer percentageFromIndex(const MassIndex &index, MassCurve curve, double isovalue,
+                                const std::vector<double> *values = nullptr);
+
+#endif // MASS_INDEX_HPP
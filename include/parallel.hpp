@@ -0,0 +1,134 @@
+/*
+ * CubeIsoFinder
+ * File: parallel.hpp
+ *
+ * Description:
+ *   Small thread-pool-free helpers for running independent tasks on all cores.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Requested number of worker threads; 0 means one per hardware thread.
+inline unsigned requestedWorkers = 0;
+
+// Set the number of worker threads (0 restores the default of one per hardware thread).
+inline void setWorkerCount(unsigned n) { requestedWorkers = n; }
+
+// Number of worker threads to use (at least 1).
+inline unsigned workerCount() {
+    unsigned n = requestedWorkers ? requestedWorkers : std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+// Run fn(i) for every i in [0, count) using up to workerCount() threads.
+// Tasks are handed out dynamically, so uneven task costs are balanced.
+// The first exception thrown by a task is rethrown in the calling thread.
+template <typename Fn>
+void parallelFor(size_t count, Fn fn) {
+    unsigned threads = static_cast<unsigned>(std::min<size_t>(workerCount(), count));
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto worker = [&]() {
+        try {
+            for (size_t i = next++; i < count; i = next++)
+                fn(i);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+            next = count;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// ----- Deterministic Reductions -----
+//
+// Floating-point sums depend on the order of the additions. To make results independent
+// of the number of threads, sums are always formed the same way: the index range is cut
+// into fixed blocks of reductionBlock elements, each block is summed front to back, and
+// the block sums are added in block order. Only the blocks are distributed over threads.
+const size_t reductionBlock = 4096;
+
+// Sum term(i) for i in [0, count) with the fixed blocking described above.
+template <typename Term>
+double blockedSum(size_t count, Term term) {
+    const size_t blocks = (count + reductionBlock - 1) / reductionBlock;
+    std::vector<double> partial(blocks, 0.0);
+    parallelFor(blocks, [&](size_t b) {
+        const size_t end = std::min(count, (b + 1) * reductionBlock);
+        double s = 0.0;
+        for (size_t i = b * reductionBlock; i < end; ++i)
+            s += term(i);
+        partial[b] = s;
+    });
+    double total = 0.0;
+    for (double s : partial)
+        total += s;
+    return total;
+}
+
+// Sort with a strict total order using all worker threads: equal-sized pieces are sorted
+// independently, then merged pairwise. Because the order is total, the result is the
+// same as std::sort for any number of threads.
+template <typename RandomIt, typename Compare>
+void parallelSort(RandomIt first, RandomIt last, Compare comp) {
+    const size_t size = static_cast<size_t>(last - first);
+    const size_t pieces = std::min<size_t>(workerCount(), std::max<size_t>(1, size / reductionBlock));
+    if (pieces <= 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+    std::vector<size_t> bounds(pieces + 1);
+    for (size_t p = 0; p <= pieces; ++p)
+        bounds[p] = size * p / pieces;
+    parallelFor(pieces, [&](size_t p) {
+        std::sort(first + bounds[p], first + bounds[p + 1], comp);
+    });
+    for (size_t width = 1; width < pieces; width *= 2) {
+        const size_t merges = (pieces + 2 * width - 1) / (2 * width);
+        parallelFor(merges, [&](size_t m) {
+            size_t lo = 2 * width * m;
+            size_t mid = std::min(pieces, lo + width);
+            size_t hi = std::min(pieces, lo + 2 * width);
+            if (mid < hi)
+                std::inplace_merge(first + bounds[lo], first + bounds[mid], first + bounds[hi], comp);
+        });
+    }
+}
+
+template <typename T, typename Compare>
+void parallelSort(std::vector<T> &data, Compare comp) {
+    parallelSort(data.begin(), data.end(), comp);
+}
+
+#endif // PARALLEL_HPP
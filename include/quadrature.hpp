@@ -0,0 +1,60 @@
+/*
+ * CubeIsoFinder
+ * File: quadrature.hpp
+ *
+ * Description:
+ *   Declares grid-aware quadrature (rectangle, trapezoid, Simpson weights with an
+ *   optional periodic wrap) and the weighted integration functions.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef QUADRATURE_HPP
+#define QUADRATURE_HPP
+
+#include "cube_parser.hpp"
+#include <string>
+#include <vector>
+
+// ----- Quadrature Weights -----
+//
+// The weight of grid point (x, y, z) is wx[x] * wy[y] * wz[z] (times the voxel volume).
+// The rectangle rule (all weights 1) is the plain voxel sum used elsewhere. On a periodic
+// grid the trapezoid rule reduces to the rectangle rule, and Simpson's rule alternates
+// 4/3 and 2/3 (even point counts only; odd periodic axes fall back to the rectangle rule).
+enum class QuadratureRule { Rectangle, Trapezoid, Simpson };
+
+// Parse "rect", "trapezoid" or "simpson". Throws a runtime_error for other names.
+QuadratureRule parseQuadratureRule(const std::string &name);
+
+// QuadratureWeights holds the per-axis weights and the product wx * wy for each z-row,
+// so the weight of flat index i is rowWeights[i / nz] * axis[2][i % nz].
+struct QuadratureWeights {
+    std::vector<double> axis[3];
+    std::vector<double> rowWeights;
+    size_t nz = 1;
+
+    double weight(size_t i) const { return rowWeights[i / nz] * axis[2][i % nz]; }
+};
+
+std::vector<double> quadratureAxisWeights(int n, QuadratureRule rule, bool periodic);
+QuadratureWeights buildQuadratureWeights(const CubeHeader &header, QuadratureRule rule, bool periodic);
+
+// ----- Weighted Integration -----
+//
+// integrateWeighted returns sum(w_i * v_i) (or sum(w_i * v_i^2) if squared) in one pass;
+// multiply by computeVoxelVolume for the integral.
+// The threshold functions follow the contract of the unweighted functions in
+// cube_parser.hpp, with each point's mass multiplied by its weight. orbital selects the
+// orbital (v^2) semantics; positive selects the sign for density data.
+double integrateWeighted(const std::vector<double> &values, const QuadratureWeights &weights, bool squared);
+double computeIsovalueFromPercentage_Weighted(const std::vector<double> &values, const QuadratureWeights &weights,
+                                              double percent, bool orbital, bool positive, bool interpolate = false);
+double computePercentageFromIsovalue_Weighted(const std::vector<double> &values, const QuadratureWeights &weights,
+                                              double isovalue, bool orbital, bool positive, bool interpolate = false);
+
+#endif // QUADRATURE_HPP
@@ -0,0 +1,57 @@
+/*
+ * CubeIsoFinder
+ * File: quantized_grid.hpp
+ *
+ * Description:
+ *   Declares lossy-bounded 16-bit quantization of grid values and the integration
+ *   functions that operate directly on the quantized codes, used to report the error
+ *   that quantized storage would induce.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef QUANTIZED_GRID_HPP
+#define QUANTIZED_GRID_HPP
+
+#include "cube_parser.hpp"
+#include <cstdint>
+#include <vector>
+
+// QuantizedGrid is a compact 16-bit representation of the grid values.
+// Bit 15 holds the sign; bits 0-14 hold a logarithmic magnitude index m, with m = 0
+// meaning zero and |v| = exp(logMin + (m - 1) * logStep) otherwise. Each value is
+// reproduced with a relative error of at most relativeError.
+struct QuantizedGrid {
+    std::vector<uint16_t> codes;
+    double logMin = 0.0;
+    double logStep = 0.0;
+    double relativeError = 0.0;
+};
+
+// ----- Quantization -----
+//
+// Magnitudes are quantized on a logarithmic scale, so the relative error bound holds
+// for every value down to the smallest representable magnitude. With 32767 levels the
+// dynamic range is exp(32766 * logStep); values below it are stored as zero.
+// A relative error of 1e-3 covers about 28 decades below the largest magnitude.
+QuantizedGrid quantizeGrid(const std::vector<double> &values, double relativeError);
+std::vector<double> dequantizeGrid(const QuantizedGrid &grid);
+
+// Table mapping every 16-bit code to its signed value; used for on-the-fly dequantization.
+std::vector<double> buildDequantizationTable(const QuantizedGrid &grid);
+
+// ----- Integration on Quantized Grids -----
+//
+// Same semantics as the corresponding functions in cube_parser.hpp. The codes are
+// monotonic in magnitude, so the isovalue search counts codes in a histogram instead
+// of sorting the grid.
+double computeIsovalueFromPercentage_Density(const QuantizedGrid &grid, double percent, bool positive);
+double computePercentageFromIsovalue_Density(const QuantizedGrid &grid, double isovalue, bool positive);
+double computeIsovalueFromPercentage_Orbital(const QuantizedGrid &grid, double percent, bool positive);
+double computePercentageFromIsovalue_Orbital(const QuantizedGrid &grid, double isovalue, bool positive);
+
+#endif // QUANTIZED_GRID_HPP
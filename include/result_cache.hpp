@@ -0,0 +1,86 @@
+/*
+ * CubeIsoFinder
+ * File: result_cache.hpp
+ *
+ * Description:
+ *   Declares the content hash of input files and the on-disk cache of analysis results.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// ----- Content Hash -----
+//
+// hashBytes is the 64-bit xxHash (XXH64) of a byte range. The input is consumed in
+// 32-byte stripes by four independent accumulators, which the compiler can keep in
+// vector registers. hashFile hashes the memory-mapped contents of a file.
+uint64_t hashBytes(const char *data, size_t size, uint64_t seed = 0);
+uint64_t hashFile(const std::string &filename);
+
+// ----- Result Cache -----
+//
+// A cached result is the complete text output of an analysis. It is stored in the cache
+// directory under a key that hashes the file contents, a canonical description of the
+// query and the tool version, so a changed file, query or version never hits an old
+// entry. The file name is not part of the key: it is stored as fileNamePlaceholder in the
+// "Processing file" line that starts the output and substituted on load. Entries are
+// written to a temporary file and renamed, so concurrent runs never read a partial entry.
+const char *const fileNamePlaceholder = "{cube_file}";
+
+// $CUBEISOFINDER_CACHE, else $XDG_CACHE_HOME/cubeisofinder, else ~/.cache/cubeisofinder.
+std::string defaultCacheDirectory();
+std::string resultCacheKey(uint64_t contentHash, const std::string &query);
+bool loadCachedResult(const std::string &directory, const std::string &key, const std::string &filename,
+                      std::string &output);
+void storeCachedResult(const std::string &directory, const std::string &key, const std::string &output);
+
+// ResultRecorder copies everything written to std::cout while it exists and stores it in
+// the cache when destroyed, unless discard() was called (e.g. after an error).
+class ResultRecorder {
+public:
+    ResultRecorder(std::string directory, std::string key, std::string filename);
+    ~ResultRecorder();
+
+    ResultRecorder(const ResultRecorder &) = delete;
+    ResultRecorder &operator=(const ResultRecorder &) = delete;
+
+    void discard() { discarded_ = true; }
+
+private:
+    // Forwards characters to the original buffer and keeps a copy.
+    class TeeBuffer : public std::streambuf {
+    public:
+        TeeBuffer(std::streambuf *target, std::string &copy) : target_(target), copy_(copy) {}
+
+    protected:
+        int overflow(int c) override;
+        std::streamsize xsputn(const char *s, std::streamsize n) override;
+        int sync() override { return target_->pubsync(); }
+
+    private:
+        std::streambuf *target_;
+        std::string &copy_;
+    };
+
+    std::string directory_;
+    std::string key_;
+    std::string filename_;
+    std::string output_;
+    TeeBuffer tee_;
+    std::streambuf *original_;
+    bool discarded_ = false;
+};
+
+#endif // RESULT_CACHE_HPP
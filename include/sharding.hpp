@@ -0,0 +1,84 @@
+/*
+ * CubeIsoFinder
+ * File: sharding.hpp
+ *
+ * Description:
+ *   Declares batch processing of a cube manifest in shards, the partial result files
+ *   written by each shard and their merge.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef SHARDING_HPP
+#define SHARDING_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ----- Cube Manifests -----
+//
+// A manifest lists one cube file per line; blank lines and lines starting with '#' are
+// ignored. Relative paths are taken relative to the directory of the manifest, so the
+// same manifest can be used on every node of a shared file system.
+struct Manifest {
+    uint64_t contentHash; // hashFile of the manifest, identifies the batch.
+    std::vector<std::string> files;
+};
+
+Manifest readManifest(const std::string &filename);
+
+// ----- Shards and Partial Results -----
+//
+// Shard i of N processes the manifest entries with index % N == i, in manifest order, so
+// the assignment depends only on the manifest and N. Each shard writes one partial
+// result file; a failing cube is recorded as an error entry instead of aborting the shard.
+// The merge checks that all partials belong to the same manifest and query, that every
+// shard is present exactly once and that every entry is covered, and returns the entries
+// in manifest order. Values are written with 17 significant digits, so merged results
+// equal those of single-file runs.
+struct ShardQuery {
+    bool usePercentage;
+    double inputValue;
+    bool positive;
+    bool interpolate;
+    bool allowTruncated;
+};
+
+struct ShardEntry {
+    size_t index;          // Position in the manifest.
+    std::string file;
+    bool ok;
+    std::string message;   // Error message if !ok.
+    bool isOrbital;
+    double total;          // Integrated quantity (native units).
+    double isovalue;       // Native isovalue (the input value for -v).
+    double percentage;     // Percentage enclosed by the isovalue.
+};
+
+struct ShardPartial {
+    uint64_t manifestHash;
+    size_t manifestEntries;
+    size_t shard;
+    size_t shardCount;
+    std::string query;     // Canonical description of the ShardQuery.
+    std::vector<ShardEntry> entries;
+};
+
+std::string describeShardQuery(const ShardQuery &query);
+
+// Parses "i/N".
+void parseShardSpec(const std::string &spec, size_t &shard, size_t &shardCount);
+
+ShardPartial runShard(const Manifest &manifest, size_t shard, size_t shardCount, const ShardQuery &query);
+void writeShardPartial(const ShardPartial &partial, const std::string &filename);
+ShardPartial readShardPartial(const std::string &filename);
+
+// Returns all entries in manifest order; throws if the partials are inconsistent or incomplete.
+std::vector<ShardEntry> mergeShardPartials(const std::vector<ShardPartial> &partials);
+
+#endif // SHARDING_HPP
@@ -0,0 +1,74 @@
+/*
+ * CubeIsoFinder
+ * File: spatial_analysis.hpp
+ *
+ * Description:
+ *   Declares position-dependent analyses of the grid data: radial profiles around
+ *   atoms or user-given points and spatial moments of thresholded regions.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef SPATIAL_ANALYSIS_HPP
+#define SPATIAL_ANALYSIS_HPP
+
+#include "cube_parser.hpp"
+#include <vector>
+
+// ----- Grid Coordinates -----
+//
+// The position of grid point (i, j, k) is origin + i a_0 + j a_1 + k a_2. GridCoordinates
+// stores the per-axis terms, so a position is the sum of three table entries:
+// position = axis[0][i] + axis[1][j] + axis[2][k] (the origin is folded into axis[0]).
+struct GridCoordinates {
+    std::vector<double> axis[3]; // axis[a][3 * i + c]: component c of the axis-a term.
+};
+
+GridCoordinates buildGridCoordinates(const CubeHeader &header);
+
+// ----- Radial Profiles -----
+//
+// RadialProfile bins the integrated quantity (density, or psi^2 for orbitals) by the
+// distance from a centre. Shell b covers [b * binWidth, (b + 1) * binWidth); the bins
+// extend to the grid corner farthest from the centre, so every grid point is counted.
+// Values are integrated quantities (multiplied by the voxel volume), in native units.
+struct RadialProfile {
+    double center[3];
+    double binWidth;
+    std::vector<double> shell;      // Quantity in each shell.
+    std::vector<double> cumulative; // Quantity within the outer radius of each shell.
+    double total;
+};
+
+// One parallel pass over the grid; the result does not depend on the number of threads.
+RadialProfile computeRadialProfile(const CubeData &cube, const GridCoordinates &coords, const double center[3],
+                                   double binWidth);
+
+// Radius of the sphere enclosing the given percentage of the total, interpolated linearly
+// within the shell where the cumulative quantity reaches it.
+double radiusEnclosingPercentage(const RadialProfile &profile, double percent);
+
+// ----- Region Moments -----
+//
+// RegionMoments describes the region enclosed by an isovalue, using the same selection as
+// the integration functions (density: v >= isovalue, or v <= isovalue for the negative
+// sign; orbitals: v^2 >= isovalue^2). Points are weighted with the density (psi^2 for
+// orbitals). All quantities are in native units.
+struct RegionMoments {
+    size_t points;              // Number of grid points in the region.
+    double mass;                // Integrated quantity in the region.
+    double centroid[3];         // Weighted mean position.
+    double firstMoment[3];      // Integral of rho * r; the electronic dipole is its negative.
+    double secondMoments[3][3]; // Weighted covariance of the position about the centroid.
+    double radiusOfGyration;    // sqrt(trace(secondMoments)).
+};
+
+// One parallel pass over the grid; the result does not depend on the number of threads.
+RegionMoments computeRegionMoments(const CubeData &cube, const GridCoordinates &coords, double isovalue,
+                                   bool positive);
+
+#endif // SPATIAL_ANALYSIS_HPP
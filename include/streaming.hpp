@@ -0,0 +1,77 @@
+/*
+ * CubeIsoFinder
+ * File: streaming.hpp
+ *
+ * Description:
+ *   Declares the parse/analysis pipeline for text cube files and the streaming
+ *   isovalue-to-percentage computation built on it, which never stores the grid.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef STREAMING_HPP
+#define STREAMING_HPP
+
+#include "cube_parser.hpp"
+#include "mapped_file.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+
+// ----- Parse/Analysis Pipeline -----
+//
+// CubeValueStream decodes the data block of a text cube on a producer thread into a
+// bounded ring of blocks (queueSlots blocks of reductionBlock values). The blocks are
+// handed to a consumer on the calling thread in file order, so analysis runs concurrently
+// with parsing while the results stay those of a sequential pass. When the ring is full,
+// the producer waits for the consumer, so memory use is bounded. With a single worker
+// thread both stages run alternately on the calling thread.
+//
+// The consumer receives each block with the grid index of its first value. The header is
+// parsed on construction, so a consumer can be set up from it. The consumers are the
+// --stream reduction and the slab loader of the distributed mode, which need no complete
+// grid. The default -p path orders the whole grid and cannot start before the last value
+// is read; it loads text cubes with the row-parallel parser instead, which is faster than
+// this single producer whenever the layout is fixed.
+using BlockConsumer = std::function<void(const double *values, size_t count, size_t firstIndex)>;
+
+class CubeValueStream {
+public:
+    static const size_t queueSlots = 8;
+
+    explicit CubeValueStream(const std::string &filename);
+
+    const CubeHeader &header() const { return header_; }
+
+    // Stream all values to consume and return the number of values read. Throws on a
+    // malformed value or a wrong number of values, unless allowTruncated is set.
+    size_t run(const BlockConsumer &consume, bool allowTruncated = false);
+
+private:
+    MappedFile file_;
+    CubeHeader header_;
+    size_t dataOffset_ = 0;
+};
+
+// ----- Streaming Percentage From Isovalue -----
+//
+// The percentage enclosed by an isovalue needs no ordering of the grid, only sums. The
+// blocks of a CubeValueStream are reduced as they arrive, so memory use does not depend
+// on the grid size. Blocks are reduced front to back and combined in file order, which
+// is exactly how blockedSum forms its sums: the percentage is bit-identical to
+// computePercentageFromIsovalue_Density/_Orbital on the loaded grid.
+struct StreamingResult {
+    CubeHeader header;
+    size_t points;      // Number of values read.
+    double sum;         // Sum of all values (of v^2 for orbitals), not scaled by the voxel volume.
+    double percentage;  // Percentage enclosed by the isovalue.
+};
+
+StreamingResult streamPercentageFromIsovalue(const std::string &filename, double isovalue, bool positive,
+                                             bool interpolate, bool allowTruncated = false);
+
+#endif // STREAMING_HPP
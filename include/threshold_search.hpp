@@ -0,0 +1,165 @@
+/*
+ * CubeIsoFinder
+ * File: threshold_search.hpp
+ *
+ * Description:
+ *   Shared building blocks of the isovalue search: locating the threshold crossing in
+ *   mass order and interpolating between bracketing grid levels.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef THRESHOLD_SEARCH_HPP
+#define THRESHOLD_SEARCH_HPP
+
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// ThresholdCrossing describes where the cumulative mass reaches the target.
+// The crossing level is the tie group [groupBegin, groupEnd) containing index.
+struct ThresholdCrossing {
+    size_t index;       // First element at which the cumulative mass reaches the target.
+    size_t groupBegin;  // First element of the crossing level.
+    size_t groupEnd;    // One past the last element of the crossing level.
+    double massBefore;  // Cumulative mass of all levels above the crossing level.
+    double massThrough; // Cumulative mass including the whole crossing level.
+};
+
+// Locate the first element (in mass order) at which the cumulative mass reaches
+// target. mass(i) must be non-negative and sameLevel(i, j) must report ties. The
+// cumulative mass at i is the sum of all complete blocks before i plus the running sum
+// within i's block, which is exactly how blockedSum forms the total.
+template <typename Mass, typename SameLevel>
+ThresholdCrossing findThresholdCrossing(size_t count, Mass mass, SameLevel sameLevel, double target) {
+    const size_t blocks = (count + reductionBlock - 1) / reductionBlock;
+    std::vector<double> partial(blocks, 0.0);
+    parallelFor(blocks, [&](size_t b) {
+        const size_t end = std::min(count, (b + 1) * reductionBlock);
+        double s = 0.0;
+        for (size_t i = b * reductionBlock; i < end; ++i)
+            s += mass(i);
+        partial[b] = s;
+    });
+    std::vector<double> prefix(blocks + 1, 0.0);
+    for (size_t b = 0; b < blocks; ++b)
+        prefix[b + 1] = prefix[b] + partial[b];
+    // Cumulative mass through element i (inclusive).
+    auto cumulative = [&](size_t i) {
+        size_t b = i / reductionBlock;
+        double running = 0.0;
+        for (size_t j = b * reductionBlock; j <= i; ++j)
+            running += mass(j);
+        return prefix[b] + running;
+    };
+
+    ThresholdCrossing c;
+    c.index = count - 1;
+    for (size_t b = 0; b < blocks; ++b) {
+        if (prefix[b + 1] >= target || b + 1 == blocks) {
+            const size_t end = std::min(count, (b + 1) * reductionBlock);
+            double running = 0.0;
+            for (size_t i = b * reductionBlock; i < end; ++i) {
+                running += mass(i);
+                if (prefix[b] + running >= target) {
+                    c.index = i;
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    c.groupBegin = c.index;
+    while (c.groupBegin > 0 && sameLevel(c.groupBegin - 1, c.index))
+        --c.groupBegin;
+    c.groupEnd = c.index + 1;
+    while (c.groupEnd < count && sameLevel(c.groupEnd, c.index))
+        ++c.groupEnd;
+    c.massBefore = c.groupBegin > 0 ? cumulative(c.groupBegin - 1) : 0.0;
+    c.massThrough = cumulative(c.groupEnd - 1);
+    return c;
+}
+
+// Interpolated threshold magnitude: the enclosed mass is taken to vary linearly between
+// the level above the crossing (upper, enclosing massBefore) and the crossing level
+// (lower, enclosing massThrough).
+inline double interpolateLevel(double upper, double lower, const ThresholdCrossing &c, double target) {
+    if (c.massThrough <= c.massBefore)
+        return lower;
+    double frac = (target - c.massBefore) / (c.massThrough - c.massBefore);
+    frac = std::min(1.0, std::max(0.0, frac));
+    return upper + frac * (lower - upper);
+}
+
+// EnclosedMassAccumulator collects, for a threshold magnitude t, the mass at magnitudes
+// >= t, the smallest such magnitude (upper) and the largest magnitude below t (lower) with
+// its mass. Accumulators of consecutive blocks are combined with merge in block order.
+struct EnclosedMassAccumulator {
+    double enclosed = 0.0;
+    double upper = std::numeric_limits<double>::infinity();
+    double lower = -1.0;
+    double lowerMass = 0.0;
+
+    void add(double a, double m, double t) {
+        if (a >= t) {
+            enclosed += m;
+            upper = std::min(upper, a);
+        }
+        else if (a > lower) {
+            lower = a;
+            lowerMass = m;
+        }
+        else if (a == lower) {
+            lowerMass += m;
+        }
+    }
+
+    void merge(const EnclosedMassAccumulator &r) {
+        enclosed += r.enclosed;
+        upper = std::min(upper, r.upper);
+        if (r.lower > lower) {
+            lower = r.lower;
+            lowerMass = r.lowerMass;
+        }
+        else if (r.lower == lower) {
+            lowerMass += r.lowerMass;
+        }
+    }
+
+    // Enclosed mass with linear interpolation between the bracketing levels.
+    double interpolated(double t) const {
+        if (lower < 0.0 || upper == std::numeric_limits<double>::infinity())
+            return enclosed;
+        return enclosed + (upper - t) / (upper - lower) * lowerMass;
+    }
+};
+
+// Enclosed mass at threshold magnitude t with linear interpolation between the two
+// grid levels bracketing t: upper (the smallest magnitude >= t) and lower (the largest
+// magnitude < t). Only points with selected(i) take part. Block results are combined in
+// block order, so the result does not depend on the number of threads.
+template <typename Magnitude, typename Mass, typename Selected>
+double interpolatedEnclosedMass(size_t count, Magnitude magnitude, Mass mass, Selected selected, double t) {
+    const size_t blocks = (count + reductionBlock - 1) / reductionBlock;
+    std::vector<EnclosedMassAccumulator> partial(blocks);
+    parallelFor(blocks, [&](size_t b) {
+        const size_t end = std::min(count, (b + 1) * reductionBlock);
+        EnclosedMassAccumulator r;
+        for (size_t i = b * reductionBlock; i < end; ++i)
+            if (selected(i))
+                r.add(magnitude(i), mass(i), t);
+        partial[b] = r;
+    });
+    EnclosedMassAccumulator all;
+    for (const auto &r : partial)
+        all.merge(r);
+    return all.interpolated(t);
+}
+
+#endif // THRESHOLD_SEARCH_HPP
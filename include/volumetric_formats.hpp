@@ -0,0 +1,46 @@
+/*
+ * CubeIsoFinder
+ * File: volumetric_formats.hpp
+ *
+ * Description:
+ *   Declares readers for non-cube volumetric formats (VASP CHGCAR, XSF DATAGRID_3D)
+ *   and the format-detecting loader used by all analysis modes.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#ifndef VOLUMETRIC_FORMATS_HPP
+#define VOLUMETRIC_FORMATS_HPP
+
+#include "cube_parser.hpp"
+#include <string>
+
+// ----- Other Volumetric Formats -----
+//
+// The readers produce a CubeData in the same conventions as readCubeFile: the values
+// are reordered to x-major order (z fastest), and the header is expressed in bohr with
+// "bohr" in comment2 so that detectAngstrom reports the right unit.
+//
+// VASP CHGCAR/CHG/AECCAR/PARCHG files store rho * V_cell on a periodic grid (x fastest).
+// The reader divides by the cell volume, so the values become densities in
+// electrons/bohr^3. Only the first data set (the total density) is read.
+//
+// XSF DATAGRID_3D blocks (XCrySDen, Quantum ESPRESSO pp.x) store a general grid that
+// includes both boundary planes. For periodic structures (a PRIMVEC block is present)
+// the duplicated last plane along each axis is dropped. Values are taken to be in
+// electrons/Å^3 and converted to electrons/bohr^3.
+CubeData readChgcarFile(const std::string &filename);
+CubeData readXsfFile(const std::string &filename);
+
+// Load a volumetric file in any supported format, detected from the file contents:
+// binary .cubeb, XSF, VASP CHGCAR, or a text cube.
+enum class VolumetricFormat { CubeBinary, Xsf, Chgcar, Cube };
+
+VolumetricFormat detectVolumetricFormat(const std::string &filename);
+CubeData loadCube(const std::string &filename, bool allowTruncated = false);
+
+#endif // VOLUMETRIC_FORMATS_HPP
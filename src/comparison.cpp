@@ -0,0 +1,88 @@
+/*
+ * CubeIsoFinder
+ * File: comparison.cpp
+ *
+ * Description:
+ *   Implements the comparison of several cubes on a common grid.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "comparison.hpp"
+#include "parallel.hpp"
+#include "volumetric_formats.hpp"
+#include <cmath>
+#include <stdexcept>
+
+bool sameGrid(const CubeHeader &a, const CubeHeader &b) {
+    const double tolerance = 1e-6;
+    for (int i = 0; i < 3; ++i) {
+        if (a.dims[i] != b.dims[i] || std::abs(a.origin[i] - b.origin[i]) > tolerance)
+            return false;
+        for (int c = 1; c < 4; ++c)
+            if (std::abs(a.axisVectors[i][c] - b.axisVectors[i][c]) > tolerance)
+                return false;
+    }
+    return true;
+}
+
+CubeComparison compareCubes(const std::vector<std::string> &filenames, double percent, bool positive,
+                            bool interpolate, bool allowTruncated) {
+    if (filenames.size() < 2)
+        throw std::runtime_error("A comparison needs at least two files.");
+    const size_t n = filenames.size();
+    // One file at a time: each parse is parallel already, and nesting it in a parallel
+    // loop over the files would start workers x files threads.
+    std::vector<CubeData> cubes(n);
+    for (size_t i = 0; i < n; ++i)
+        cubes[i] = loadCube(filenames[i], allowTruncated);
+
+    CubeComparison result;
+    result.header = cubes[0].header;
+    const bool orbital = result.header.isOrbital;
+    for (size_t i = 1; i < n; ++i) {
+        if (!sameGrid(cubes[i].header, result.header))
+            throw std::runtime_error("The grid of " + filenames[i] + " differs from that of " + filenames[0] + ".");
+        if (cubes[i].header.isOrbital != orbital)
+            throw std::runtime_error("The data type of " + filenames[i] + " differs from that of " + filenames[0] +
+                                     ".");
+        if (cubes[i].values.size() != cubes[0].values.size())
+            throw std::runtime_error("The number of grid points of " + filenames[i] + " differs from that of " +
+                                     filenames[0] + ".");
+    }
+
+    const double voxelVolume = computeVoxelVolume(result.header);
+    for (const CubeData &cube : cubes) {
+        result.isovalues.push_back(
+            orbital ? computeIsovalueFromPercentage_Orbital(cube.values, percent, positive, interpolate)
+                    : computeIsovalueFromPercentage_Density(cube.values, percent, positive, interpolate));
+        result.totals.push_back(blockedSum(cube.values.size(), [&](size_t k) {
+                                    double v = cube.values[k];
+                                    return orbital ? v * v : v;
+                                }) *
+                                voxelVolume);
+    }
+    // One multi-threshold pass per file gives a column of the cross matrix. The pass
+    // counts grid points exactly, so with interpolate each entry uses the interpolated
+    // model instead, which keeps the diagonal at the requested percentage.
+    result.cross.assign(n, std::vector<double>(n, 0.0));
+    for (size_t j = 0; j < n; ++j) {
+        std::vector<double> column;
+        if (interpolate) {
+            for (double isovalue : result.isovalues)
+                column.push_back(
+                    orbital ? computePercentageFromIsovalue_Orbital(cubes[j].values, isovalue, positive, true)
+                            : computePercentageFromIsovalue_Density(cubes[j].values, isovalue, positive, true));
+        }
+        else {
+            column = computePercentagesFromIsovalues(cubes[j].values, result.isovalues, orbital, positive);
+        }
+        for (size_t i = 0; i < n; ++i)
+            result.cross[i][j] = column[i];
+    }
+    return result;
+}
@@ -0,0 +1,347 @@
+/*
+ * CubeIsoFinder
+ * File: cube_binary.cpp
+ *
+ * Description:
+ *   Implements the compact binary cube format (.cubeb) and its chunk codec.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "cube_binary.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char kMagic[8] = {'C', 'U', 'B', 'E', 'B', '0', '1', '\n'};
+
+// ----- Chunk Codec -----
+//
+// Neighbouring grid values are close, so XOR-ing the bit pattern of each value with
+// its predecessor leaves mostly zero high bytes (sign, exponent, leading mantissa).
+// Shuffling the bytes into 8 planes groups those zeros together, and a zero-run
+// encoding (0x00 followed by a run length of 1-255) removes them.
+
+std::vector<unsigned char> compressChunk(const double *values, size_t count) {
+    std::vector<unsigned char> shuffled(count * 8);
+    uint64_t prev = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t bits;
+        std::memcpy(&bits, &values[i], 8);
+        uint64_t delta = bits ^ prev;
+        prev = bits;
+        for (int b = 0; b < 8; ++b)
+            shuffled[b * count + i] = static_cast<unsigned char>(delta >> (8 * b));
+    }
+    std::vector<unsigned char> out;
+    out.reserve(shuffled.size() / 2);
+    for (size_t i = 0; i < shuffled.size();) {
+        if (shuffled[i] != 0) {
+            out.push_back(shuffled[i++]);
+            continue;
+        }
+        size_t run = 1;
+        while (run < 255 && i + run < shuffled.size() && shuffled[i + run] == 0)
+            ++run;
+        out.push_back(0);
+        out.push_back(static_cast<unsigned char>(run));
+        i += run;
+    }
+    return out;
+}
+
+void decompressChunk(const unsigned char *in, size_t inBytes, double *values, size_t count) {
+    std::vector<unsigned char> shuffled(count * 8);
+    size_t o = 0;
+    for (size_t i = 0; i < inBytes;) {
+        if (in[i] != 0) {
+            if (o >= shuffled.size())
+                throw std::runtime_error("Error: Corrupted .cubeb chunk.");
+            shuffled[o++] = in[i++];
+            continue;
+        }
+        if (i + 1 >= inBytes || o + in[i + 1] > shuffled.size())
+            throw std::runtime_error("Error: Corrupted .cubeb chunk.");
+        o += in[i + 1]; // The buffer is zero-initialized.
+        i += 2;
+    }
+    if (o != shuffled.size())
+        throw std::runtime_error("Error: Corrupted .cubeb chunk.");
+    uint64_t prev = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t delta = 0;
+        for (int b = 0; b < 8; ++b)
+            delta |= static_cast<uint64_t>(shuffled[b * count + i]) << (8 * b);
+        prev ^= delta;
+        std::memcpy(&values[i], &prev, 8);
+    }
+}
+
+// ----- Serialization Helpers -----
+
+template <typename T>
+void writePod(std::ofstream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void writeString(std::ofstream &out, const std::string &s) {
+    writePod(out, static_cast<uint32_t>(s.size()));
+    out.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+// Bounds-checked sequential reader over a mapped file.
+struct ByteReader {
+    const char *data;
+    size_t size;
+    size_t pos;
+
+    void need(size_t n) const {
+        if (pos + n > size)
+            throw std::runtime_error("Error: Unexpected end of .cubeb file.");
+    }
+    template <typename T>
+    T pod() {
+        need(sizeof(T));
+        T value;
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    std::string str() {
+        uint32_t len = pod<uint32_t>();
+        need(len);
+        std::string s(data + pos, len);
+        pos += len;
+        return s;
+    }
+};
+
+CubeBinaryInfo parseInfo(const MappedFile &file) {
+    if (file.size() < sizeof(kMagic) || std::memcmp(file.data(), kMagic, sizeof(kMagic)) != 0)
+        throw std::runtime_error("Error: Not a .cubeb file.");
+    ByteReader r{file.data(), file.size(), sizeof(kMagic)};
+    CubeBinaryInfo info;
+    CubeHeader &h = info.header;
+    h.comment1 = r.str();
+    h.comment2 = r.str();
+    h.calcType = r.str();
+    h.extraLine = r.str();
+    h.isOrbital = r.pod<uint8_t>() != 0;
+    h.numAtoms = r.pod<int32_t>();
+    for (int i = 0; i < 3; ++i)
+        h.origin[i] = r.pod<double>();
+    for (int i = 0; i < 3; ++i) {
+        h.dims[i] = r.pod<int32_t>();
+        for (int j = 0; j < 4; ++j)
+            h.axisVectors[i][j] = r.pod<double>();
+        if (h.dims[i] <= 0)
+            throw std::runtime_error("Error: Corrupted .cubeb file (non-positive grid dimension).");
+    }
+    // Counts are checked against the bytes left before anything is allocated.
+    uint32_t atomCount = r.pod<uint32_t>();
+    const size_t atomRecord = 4 + 8 + 3 * 8;
+    if (h.numAtoms == std::numeric_limits<int32_t>::min() ||
+        atomCount != static_cast<uint32_t>(std::abs(h.numAtoms)) || atomCount > (r.size - r.pos) / atomRecord)
+        throw std::runtime_error("Error: Corrupted .cubeb file (invalid atom count).");
+    h.atoms.resize(atomCount);
+    for (auto &a : h.atoms) {
+        a.atomicNumber = r.pod<int32_t>();
+        a.charge = r.pod<double>();
+        for (int j = 0; j < 3; ++j)
+            a.position[j] = r.pod<double>();
+    }
+    info.planesPerChunk = r.pod<uint32_t>();
+    uint32_t chunkCount = r.pod<uint32_t>();
+    const size_t chunkRecord = 8 + 8 + 4 + 4;
+    if (chunkCount > (r.size - r.pos) / chunkRecord)
+        throw std::runtime_error("Error: Corrupted .cubeb file (invalid chunk count).");
+    info.chunks.resize(chunkCount);
+    for (auto &c : info.chunks) {
+        c.offset = r.pod<uint64_t>();
+        c.compressedBytes = r.pod<uint64_t>();
+        c.firstPlane = r.pod<uint32_t>();
+        c.planeCount = r.pod<uint32_t>();
+        if (c.offset > file.size() || c.compressedBytes > file.size() - c.offset)
+            throw std::runtime_error("Error: Corrupted .cubeb file (chunk index points past the end of the file).");
+    }
+    // The chunks must cover the planes [0, dims[0]) in order, without gaps or overlaps.
+    uint64_t nextPlane = 0;
+    for (const auto &c : info.chunks) {
+        if (c.firstPlane != nextPlane || c.planeCount == 0)
+            throw std::runtime_error("Error: Corrupted .cubeb file (chunks are not contiguous).");
+        nextPlane = static_cast<uint64_t>(c.firstPlane) + c.planeCount;
+    }
+    if (nextPlane != static_cast<uint64_t>(h.dims[0]))
+        throw std::runtime_error("Error: Corrupted .cubeb file (chunks do not cover the grid).");
+    // Two bytes of chunk data decode to at most 255 of the 8 bytes per value, so a chunk
+    // holds at most 16 values per byte. This bounds the grid by the file size and keeps
+    // the size computations of the readers from overflowing.
+    uint64_t maxPoints = 0;
+    for (const auto &c : info.chunks)
+        maxPoints += c.compressedBytes * 16;
+    const uint64_t plane = static_cast<uint64_t>(h.dims[1]) * static_cast<uint64_t>(h.dims[2]);
+    if (plane > maxPoints || static_cast<uint64_t>(h.dims[0]) > maxPoints / plane)
+        throw std::runtime_error("Error: Corrupted .cubeb file (grid larger than the chunk data).");
+    return info;
+}
+
+size_t planeSize(const CubeHeader &h) {
+    return static_cast<size_t>(h.dims[1]) * static_cast<size_t>(h.dims[2]);
+}
+
+// Decompress the chunks overlapping planes [firstPlane, firstPlane + planeCount) in
+// parallel and copy the requested planes into out.
+void decodePlanes(const MappedFile &file, const CubeBinaryInfo &info,
+                  int firstPlane, int planeCount, double *out) {
+    const size_t ps = planeSize(info.header);
+    std::vector<const CubeBinaryChunk *> selected;
+    for (const auto &c : info.chunks) {
+        int cEnd = static_cast<int>(c.firstPlane + c.planeCount);
+        if (cEnd > firstPlane && static_cast<int>(c.firstPlane) < firstPlane + planeCount)
+            selected.push_back(&c);
+    }
+    parallelFor(selected.size(), [&](size_t k) {
+        const CubeBinaryChunk &c = *selected[k];
+        const unsigned char *src = reinterpret_cast<const unsigned char *>(file.data() + c.offset);
+        int lo = std::max<int>(firstPlane, static_cast<int>(c.firstPlane));
+        int hi = std::min<int>(firstPlane + planeCount, static_cast<int>(c.firstPlane + c.planeCount));
+        double *dst = out + static_cast<size_t>(lo - firstPlane) * ps;
+        if (lo == static_cast<int>(c.firstPlane) && hi == static_cast<int>(c.firstPlane + c.planeCount)) {
+            decompressChunk(src, c.compressedBytes, dst, c.planeCount * ps);
+            return;
+        }
+        std::vector<double> tmp(c.planeCount * ps);
+        decompressChunk(src, c.compressedBytes, tmp.data(), tmp.size());
+        std::copy(tmp.begin() + static_cast<size_t>(lo - c.firstPlane) * ps,
+                  tmp.begin() + static_cast<size_t>(hi - c.firstPlane) * ps, dst);
+    });
+}
+
+} // namespace
+
+bool isCubeBinaryFile(const std::string &filename) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+// Write a CubeData structure in the .cubeb format.
+// Chunks are compressed in parallel, then written behind the header and chunk index.
+void writeCubeBinary(const CubeData &cube, const std::string &filename, uint32_t planesPerChunk) {
+    const CubeHeader &h = cube.header;
+    const size_t ps = planeSize(h);
+    const uint32_t planes = static_cast<uint32_t>(h.dims[0]);
+    if (cube.values.size() != ps * planes)
+        throw std::runtime_error("Error: Grid size does not match the header; cannot write .cubeb file.");
+    if (planesPerChunk == 0)
+        planesPerChunk = static_cast<uint32_t>(std::max<size_t>(1, (1u << 20) / std::max<size_t>(ps, 1)));
+
+    std::vector<CubeBinaryChunk> chunks;
+    for (uint32_t p = 0; p < planes; p += planesPerChunk)
+        chunks.push_back({0, 0, p, std::min(planesPerChunk, planes - p)});
+    std::vector<std::vector<unsigned char>> encoded(chunks.size());
+    parallelFor(chunks.size(), [&](size_t k) {
+        encoded[k] = compressChunk(cube.values.data() + chunks[k].firstPlane * ps, chunks[k].planeCount * ps);
+    });
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Error opening file for writing: " + filename);
+    out.write(kMagic, sizeof(kMagic));
+    writeString(out, h.comment1);
+    writeString(out, h.comment2);
+    writeString(out, h.calcType);
+    writeString(out, h.extraLine);
+    writePod(out, static_cast<uint8_t>(h.isOrbital ? 1 : 0));
+    writePod(out, static_cast<int32_t>(h.numAtoms));
+    for (int i = 0; i < 3; ++i)
+        writePod(out, h.origin[i]);
+    for (int i = 0; i < 3; ++i) {
+        writePod(out, static_cast<int32_t>(h.dims[i]));
+        for (int j = 0; j < 4; ++j)
+            writePod(out, h.axisVectors[i][j]);
+    }
+    writePod(out, static_cast<uint32_t>(h.atoms.size()));
+    for (const auto &a : h.atoms) {
+        writePod(out, static_cast<int32_t>(a.atomicNumber));
+        writePod(out, a.charge);
+        for (int j = 0; j < 3; ++j)
+            writePod(out, a.position[j]);
+    }
+    writePod(out, planesPerChunk);
+    writePod(out, static_cast<uint32_t>(chunks.size()));
+
+    // Chunk data follows the index directly.
+    uint64_t offset = static_cast<uint64_t>(out.tellp()) + chunks.size() * (8 + 8 + 4 + 4);
+    for (size_t k = 0; k < chunks.size(); ++k) {
+        chunks[k].offset = offset;
+        chunks[k].compressedBytes = encoded[k].size();
+        offset += encoded[k].size();
+        writePod(out, chunks[k].offset);
+        writePod(out, chunks[k].compressedBytes);
+        writePod(out, chunks[k].firstPlane);
+        writePod(out, chunks[k].planeCount);
+    }
+    for (const auto &e : encoded)
+        out.write(reinterpret_cast<const char *>(e.data()), static_cast<std::streamsize>(e.size()));
+    if (!out)
+        throw std::runtime_error("Error writing file: " + filename);
+}
+
+CubeBinaryInfo readCubeBinaryInfo(const std::string &filename) {
+    MappedFile file(filename);
+    return parseInfo(file);
+}
+
+CubeData readCubeBinary(const std::string &filename) {
+    MappedFile file(filename);
+    CubeBinaryInfo info = parseInfo(file);
+    CubeData cube;
+    cube.header = info.header;
+    cube.values.resize(planeSize(info.header) * static_cast<size_t>(info.header.dims[0]));
+    decodePlanes(file, info, 0, info.header.dims[0], cube.values.data());
+    return cube;
+}
+
+std::vector<double> readCubeBinarySlab(const std::string &filename, int firstPlane, int planeCount) {
+    MappedFile file(filename);
+    CubeBinaryInfo info = parseInfo(file);
+    if (firstPlane < 0 || planeCount < 0 || firstPlane + planeCount > info.header.dims[0])
+        throw std::runtime_error("Error: Requested slab lies outside the grid.");
+    std::vector<double> values(planeSize(info.header) * static_cast<size_t>(planeCount));
+    decodePlanes(file, info, firstPlane, planeCount, values.data());
+    return values;
+}
+
+std::vector<double> readCubeBinaryBox(const std::string &filename, const int lo[3], const int hi[3]) {
+    MappedFile file(filename);
+    CubeBinaryInfo info = parseInfo(file);
+    const int *dims = info.header.dims;
+    for (int a = 0; a < 3; ++a)
+        if (lo[a] < 0 || hi[a] > dims[a] || lo[a] > hi[a])
+            throw std::runtime_error("Error: Requested box lies outside the grid.");
+
+    // Only the slabs covering the box along the first axis are decompressed.
+    std::vector<double> slab(planeSize(info.header) * static_cast<size_t>(hi[0] - lo[0]));
+    decodePlanes(file, info, lo[0], hi[0] - lo[0], slab.data());
+    std::vector<double> box;
+    box.reserve(static_cast<size_t>(hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]));
+    for (int x = 0; x < hi[0] - lo[0]; ++x)
+        for (int y = lo[1]; y < hi[1]; ++y) {
+            const double *row = slab.data() + (static_cast<size_t>(x) * dims[1] + y) * dims[2];
+            box.insert(box.end(), row + lo[2], row + hi[2]);
+        }
+    return box;
+}
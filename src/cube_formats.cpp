@@ -0,0 +1,185 @@
+/*
+ * CubeIsoFinder
+ * File: cube_formats.cpp
+ *
+ * Description:
+ *   Implements the registry of cube file producers and the built-in detectors.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "cube_formats.hpp"
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+std::string readLine(const char *data, size_t size, size_t &pos) {
+    if (pos >= size)
+        return "";
+    const char *begin = data + pos;
+    const char *nl = static_cast<const char *>(std::memchr(begin, '\n', size - pos));
+    size_t len = nl ? static_cast<size_t>(nl - begin) : size - pos;
+    pos += nl ? len + 1 : len;
+    return std::string(begin, len);
+}
+
+bool inComments(const std::string &comment1, const std::string &comment2, const char *keyword) {
+    return icontains(comment1, keyword) || icontains(comment2, keyword);
+}
+
+// Every producer except ORCA follows the Gaussian header conventions.
+CubeFormatDetector gaussianStyle(const std::string &name, const char *const *keywords) {
+    CubeFormatDetector d;
+    d.name = name;
+    d.matches = [keywords](const std::string &c1, const std::string &c2) {
+        for (const char *const *k = keywords; *k; ++k)
+            if (inComments(c1, c2, *k))
+                return true;
+        return false;
+    };
+    d.readExtraHeader = readOrbitalIndexLines;
+    d.isOrbital = isOrbitalByKeywords;
+    d.units = LengthUnitRule::Bohr;
+    return d;
+}
+
+std::vector<CubeFormatDetector> builtInDetectors() {
+    std::vector<CubeFormatDetector> detectors;
+
+    // ORCA (orca_plot) writes one extra line after the atom block.
+    CubeFormatDetector orca;
+    orca.name = "ORCA";
+    orca.matches = [](const std::string &c1, const std::string &c2) { return inComments(c1, c2, "ORCA"); };
+    orca.readExtraHeader = [](const char *data, size_t size, size_t &pos, CubeHeader &header) {
+        header.extraLine = readLine(data, size, pos);
+    };
+    orca.isOrbital = isOrbitalByKeywords;
+    orca.units = LengthUnitRule::Bohr;
+    detectors.push_back(orca);
+
+    static const char *const qchem[] = {"Q-Chem", nullptr};
+    detectors.push_back(gaussianStyle("Q-Chem", qchem));
+
+    // Psi4 titles its files "Psi4 Gaussian Cube File", so it is tried before Gaussian.
+    // The second line names the property: Psi_* for orbitals, D* for densities.
+    static const char *const psi4[] = {"Psi4", nullptr};
+    CubeFormatDetector psi = gaussianStyle("Psi4", psi4);
+    psi.isOrbital = [](const CubeHeader &h) {
+        if (icontains(h.comment2, "Psi_"))
+            return true;
+        if (icontains(h.comment2, "Property: D"))
+            return false;
+        return isOrbitalByKeywords(h);
+    };
+    detectors.push_back(psi);
+
+    static const char *const multiwfn[] = {"Multiwfn", nullptr};
+    detectors.push_back(gaussianStyle("Multiwfn", multiwfn));
+
+    // CP2K (Quickstep) names the field on the second line, e.g. "ELECTRON DENSITY",
+    // "SPIN DENSITY" or "WAVEFUNCTION 5 spin 1".
+    static const char *const cp2k[] = {"Quickstep", "CP2K", nullptr};
+    CubeFormatDetector quickstep = gaussianStyle("CP2K", cp2k);
+    quickstep.isOrbital = [](const CubeHeader &h) {
+        if (icontains(h.comment2, "WAVEFUNCTION"))
+            return true;
+        if (icontains(h.comment2, "DENSITY"))
+            return false;
+        return isOrbitalByKeywords(h);
+    };
+    detectors.push_back(quickstep);
+
+    static const char *const gaussian[] = {"Gaussian", "cubegen", "SCF Density", nullptr};
+    detectors.push_back(gaussianStyle("Gaussian", gaussian));
+
+    // Formats read by their own readers; found by name only. Both are converted to bohr.
+    for (const char *name : {"VASP", "XSF"}) {
+        CubeFormatDetector d;
+        d.name = name;
+        d.units = LengthUnitRule::Bohr;
+        detectors.push_back(d);
+    }
+
+    CubeFormatDetector generic;
+    generic.name = "Generic";
+    generic.matches = [](const std::string &, const std::string &) { return true; };
+    generic.readExtraHeader = readOrbitalIndexLines;
+    generic.isOrbital = isOrbitalByKeywords;
+    detectors.push_back(generic);
+    return detectors;
+}
+
+std::vector<CubeFormatDetector> &registry() {
+    static std::vector<CubeFormatDetector> detectors = builtInDetectors();
+    return detectors;
+}
+
+size_t registeredCount = 0; // Registered detectors at the front of the registry.
+
+} // namespace
+
+void registerCubeFormatDetector(CubeFormatDetector detector) {
+    if (!detector.readExtraHeader)
+        detector.readExtraHeader = readOrbitalIndexLines;
+    if (!detector.isOrbital)
+        detector.isOrbital = isOrbitalByKeywords;
+    std::vector<CubeFormatDetector> &detectors = registry();
+    detectors.insert(detectors.begin() + registeredCount++, std::move(detector));
+}
+
+const CubeFormatDetector &detectCubeFormat(const std::string &comment1, const std::string &comment2) {
+    for (const CubeFormatDetector &d : registry())
+        if (d.matches && d.matches(comment1, comment2))
+            return d;
+    return registry().back();
+}
+
+const CubeFormatDetector *findCubeFormat(const std::string &name) {
+    for (const CubeFormatDetector &d : registry())
+        if (d.name == name)
+            return &d;
+    return nullptr;
+}
+
+void readOrbitalIndexLines(const char *data, size_t size, size_t &pos, CubeHeader &header) {
+    if (header.numAtoms >= 0)
+        return;
+    // The number of orbitals m followed by their m indices, over as many lines as needed.
+    long expected = -1, found = 0;
+    while (expected < 0 || found < expected + 1) {
+        if (pos >= size)
+            throw std::runtime_error("Error reading the orbital index line.");
+        std::string line = readLine(data, size, pos);
+        header.extraLine += (header.extraLine.empty() ? "" : "\n") + line;
+        std::istringstream in(line);
+        long value;
+        while (in >> value) {
+            if (expected < 0) {
+                if (value < 0)
+                    throw std::runtime_error("Error reading the orbital index line.");
+                expected = value;
+            }
+            ++found;
+        }
+        if (expected < 0 || !in.eof())
+            throw std::runtime_error("Error reading the orbital index line.");
+    }
+}
+
+bool isOrbitalByKeywords(const CubeHeader &header) {
+    // Explicit keywords decide first.
+    if (icontains(header.comment1, "MO") || icontains(header.comment2, "MO") ||
+        icontains(header.comment1, "Orbital") || icontains(header.comment2, "Orbital"))
+        return true;
+    if (icontains(header.comment1, "density") || icontains(header.comment2, "density"))
+        return false;
+    // Files without these keywords default to orbital.
+    return true;
+}
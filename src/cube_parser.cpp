@@ -13,11 +13,21 @@
  */
 
 #include "cube_parser.hpp"
+#include "cube_formats.hpp"
+#include "cube_text_layout.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "threshold_search.hpp"
 #include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -44,80 +54,203 @@ bool icontains(const std::string &data, const std::string &substr) {
 }
 
 
-// Read the cube file and populate a CubeData structure.
-// Throws a runtime_error if the file cannot be opened or if data reading fails.
-CubeData readCubeFile(const std::string &filename) {
-    std::ifstream infile(filename);
-    if (!infile)
-        throw std::runtime_error("Error opening file: " + filename);
+// ----- Low-Level Scanning Helpers -----
+//
+// The parser works directly on the mapped bytes of the file. Lines are located with
+// memchr and numbers are converted with std::from_chars, which never reads past the
+// end of the token and therefore never past the end of the mapping.
+namespace {
 
-    CubeData cube;
+// Return the line starting at pos (without its terminator) and advance pos past it.
+std::string nextLine(const char *data, size_t size, size_t &pos) {
+    if (pos >= size)
+        return "";
+    const char *begin = data + pos;
+    const char *nl = static_cast<const char *>(std::memchr(begin, '\n', size - pos));
+    size_t len = nl ? static_cast<size_t>(nl - begin) : size - pos;
+    pos += nl ? len + 1 : len;
+    return std::string(begin, len);
+}
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+// Lexical check of a floating-point token ([+-]digits[.digits][(e|E)[+-]digits]).
+// Cheaper than a full conversion; used by the validation scan.
+bool isNumberToken(const char *p, const char *end) {
+    if (p < end && (*p == '+' || *p == '-'))
+        ++p;
+    bool digits = false;
+    while (p < end && *p >= '0' && *p <= '9') { ++p; digits = true; }
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && *p >= '0' && *p <= '9') { ++p; digits = true; }
+    }
+    if (!digits)
+        return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        if (p < end && (*p == '+' || *p == '-'))
+            ++p;
+        bool expDigits = false;
+        while (p < end && *p >= '0' && *p <= '9') { ++p; expDigits = true; }
+        if (!expDigits)
+            return false;
+    }
+    return p == end;
+}
+
+// Convert one token to a double. Returns false if the token is not a complete number.
+bool parseNumberToken(const char *p, const char *end, double &value) {
+    if (p < end && *p == '+')
+        ++p;
+    auto result = std::from_chars(p, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+// Number of values the standard layout places on the given data line (0-based):
+// 6 per line, with each z-row of dims[2] values starting on a new line.
+int expectedValuesOnLine(size_t dataLine, int nz) {
+    if (nz <= 0)
+        return 0;
+    size_t linesPerRow = (static_cast<size_t>(nz) + 5) / 6;
+    size_t j = dataLine % linesPerRow;
+    return static_cast<int>(std::min<size_t>(6, static_cast<size_t>(nz) - 6 * j));
+}
+
+} // namespace
+
+// Append up to maxCount whitespace-separated numbers from [p, end) to out.
+// Stops at the end of the range or at the first token that is not a number, leaving p
+// at that token (or at the end). Returns the number of values appended.
+size_t scanValues(const char *&p, const char *end, std::vector<double> &out, size_t maxCount) {
+    size_t n = 0;
+    while (n < maxCount) {
+        while (p < end && isSpace(*p))
+            ++p;
+        if (p == end)
+            break;
+        const char *tokenEnd = p;
+        while (tokenEnd < end && !isSpace(*tokenEnd))
+            ++tokenEnd;
+        double val;
+        if (!parseNumberToken(p, tokenEnd, val))
+            break;
+        out.push_back(val);
+        p = tokenEnd;
+        ++n;
+    }
+    return n;
+}
+
+// Parse the cube header from an in-memory file.
+// Throws a runtime_error if the header is incomplete or malformed.
+CubeHeader parseCubeHeader(const char *data, size_t size, size_t &dataOffset) {
+    CubeHeader header;
+    size_t pos = 0;
     std::string line;
 
     // Read the first two comment lines.
-    std::getline(infile, line);
-    cube.header.comment1 = trim(line);
-    std::getline(infile, line);
-    cube.header.comment2 = trim(line);
-
-    // Detect the calculation type based on keywords in the comment lines.
-    if (icontains(cube.header.comment1, "ORCA") || icontains(cube.header.comment2, "ORCA"))
-        cube.header.calcType = "ORCA";
-    else if (icontains(cube.header.comment1, "Q-Chem") || icontains(cube.header.comment2, "Q-Chem"))
-        cube.header.calcType = "Q-Chem";
-    else
-        cube.header.calcType = "Generic";
-
-    // Detect whether the cube file contains orbital data or density data.
-    if (icontains(cube.header.comment1, "MO") || icontains(cube.header.comment2, "MO") ||
-        icontains(cube.header.comment1, "Orbital") || icontains(cube.header.comment2, "Orbital"))
-        cube.header.isOrbital = true;
-    else if (icontains(cube.header.comment1, "density") || icontains(cube.header.comment2, "density"))
-        cube.header.isOrbital = false;
-    else
-        cube.header.isOrbital = true; // Default to orbital.
+    header.comment1 = trim(nextLine(data, size, pos));
+    header.comment2 = trim(nextLine(data, size, pos));
+
+    // Select the producer from the comment lines; it decides how the rest of the header
+    // is read and how the data is classified.
+    const CubeFormatDetector &format = detectCubeFormat(header.comment1, header.comment2);
+    header.calcType = format.name;
 
     // Read the line containing the number of atoms and the grid origin.
-    std::getline(infile, line);
+    line = nextLine(data, size, pos);
     std::istringstream iss(line);
-    if (!(iss >> cube.header.numAtoms >> cube.header.origin[0] >> cube.header.origin[1] >> cube.header.origin[2]))
+    if (!(iss >> header.numAtoms >> header.origin[0] >> header.origin[1] >> header.origin[2]))
         throw std::runtime_error("Error reading number of atoms and origin.");
 
     // Read the three axis vectors.
     // Each of the next three lines contains the voxel count and the 3 vector components.
     for (int i = 0; i < 3; ++i) {
-        std::getline(infile, line);
+        line = nextLine(data, size, pos);
         std::istringstream iss_axis(line);
-        if (!(iss_axis >> cube.header.dims[i] 
-              >> cube.header.axisVectors[i][1] >> cube.header.axisVectors[i][2] >> cube.header.axisVectors[i][3])) {
+        if (!(iss_axis >> header.dims[i]
+              >> header.axisVectors[i][1] >> header.axisVectors[i][2] >> header.axisVectors[i][3])) {
             throw std::runtime_error("Error reading axis vector " + std::to_string(i));
         }
-        // Also store the voxel count as the first element of each axis vector.
-        cube.header.axisVectors[i][0] = cube.header.dims[i];
+        if (header.dims[i] == 0 || header.dims[i] == std::numeric_limits<int>::min())
+            throw std::runtime_error("Error: Invalid voxel count " + std::to_string(header.dims[i]) +
+                                     " on axis " + std::to_string(i) + ".");
+        // Also store the voxel count as the first element of each axis vector. A negative
+        // count marks the axis vectors as Angstrom; its sign is kept there.
+        header.axisVectors[i][0] = header.dims[i];
+        header.dims[i] = std::abs(header.dims[i]);
     }
 
     // Read the atom coordinate lines (one per atom).
-    int numAtoms = std::abs(cube.header.numAtoms);
+    if (header.numAtoms == std::numeric_limits<int>::min())
+        throw std::runtime_error("Error reading number of atoms and origin.");
+    int numAtoms = std::abs(header.numAtoms);
+    // Each atom line takes at least ten bytes; do not trust the count for the allocation.
+    header.atoms.reserve(std::min<size_t>(numAtoms, (size - std::min(pos, size)) / 10));
     for (int i = 0; i < numAtoms; ++i) {
-        std::getline(infile, line);
-        // Atom coordinates are read but not used in the integration.
+        line = nextLine(data, size, pos);
+        std::istringstream iss_atom(line);
+        CubeAtom atom;
+        if (!(iss_atom >> atom.atomicNumber >> atom.charge
+              >> atom.position[0] >> atom.position[1] >> atom.position[2]))
+            throw std::runtime_error("Error reading atom " + std::to_string(i));
+        header.atoms.push_back(atom);
     }
 
-    // If the cube file is from an ORCA calculation, skip one extra header line (e.g., containing MO coefficients).
-    if (cube.header.calcType == "ORCA") {
-        std::getline(infile, line); // Skip extra line.
-    }
+    // Producer-specific lines between the atoms and the data (orbital indices, ORCA's extra line).
+    format.readExtraHeader(data, size, pos, header);
+    header.isOrbital = format.isOrbital(header);
+
+    if (pos > size)
+        pos = size;
+    dataOffset = pos;
+    return header;
+}
+
+// Read the cube file and populate a CubeData structure.
+// Throws a runtime_error if the file cannot be opened or if data reading fails.
+// With allowTruncated, a short or corrupted data block yields the valid prefix instead.
+CubeData readCubeFile(const std::string &filename, bool allowTruncated) {
+    MappedFile file(filename);
+    return parseCubeData(file.data(), file.size(), allowTruncated);
+}
+
+CubeData parseCubeData(const char *data, size_t size, bool allowTruncated) {
+    CubeData cube;
+    size_t dataOffset = 0;
+    cube.header = parseCubeHeader(data, size, dataOffset);
 
     // Read the volumetric data.
     // The total number of grid points should equal dims[0] * dims[1] * dims[2].
     size_t totalPoints = static_cast<size_t>(cube.header.dims[0]) *
                          static_cast<size_t>(cube.header.dims[1]) *
                          static_cast<size_t>(cube.header.dims[2]);
-    cube.values.reserve(totalPoints);
-    double val;
-    while (infile >> val) {
-        cube.values.push_back(val);
+    // A data block with a fixed-width layout is parsed row-parallel at computed offsets.
+    CubeTextLayout layout;
+    if (probeCubeTextLayout(data, size, cube.header, dataOffset, layout) &&
+        parseCubeTextParallel(data, layout, cube.values))
+        return cube;
+    cube.values.clear();
+
+    // Every value takes at least two bytes, so a corrupt header cannot force a huge allocation.
+    cube.values.reserve(std::min(totalPoints, (size - dataOffset) / 2 + 1));
+    const char *p = data + dataOffset;
+    const char *end = data + size;
+    scanValues(p, end, cube.values, std::numeric_limits<size_t>::max());
+    while (p < end && isSpace(*p))
+        ++p;
+    if (p < end && !allowTruncated) {
+        const char *tokenEnd = p;
+        while (tokenEnd < end && !isSpace(*tokenEnd))
+            ++tokenEnd;
+        throw std::runtime_error("Error: Malformed value '" + std::string(p, tokenEnd) +
+                                 "' at byte offset " + std::to_string(p - data) + ".");
     }
+    if (allowTruncated && cube.values.size() < totalPoints)
+        return cube;
     if (cube.values.size() != totalPoints) {
         throw std::runtime_error("Error: Number of grid points read (" + std::to_string(cube.values.size()) +
                                  ") does not match expected (" + std::to_string(totalPoints) + ").");
@@ -125,6 +258,130 @@ CubeData readCubeFile(const std::string &filename) {
     return cube;
 }
 
+// Check the structure of a cube file without converting its values.
+// The expected size of the data block is first predicted from the fixed-width
+// layout of the first data row; the block is then scanned lexically line by line
+// to locate the first malformed token and any lines whose value count deviates
+// from the standard layout.
+CubeValidationReport validateCubeFile(const std::string &filename) {
+    const size_t maxStoredAnomalies = 20;
+
+    MappedFile file(filename);
+    const char *data = file.data();
+    size_t size = file.size();
+
+    CubeValidationReport report;
+    report.header = parseCubeHeader(data, size, report.dataOffset);
+    const int nz = report.header.dims[2];
+    report.expectedPoints = static_cast<size_t>(report.header.dims[0]) *
+                            static_cast<size_t>(report.header.dims[1]) *
+                            static_cast<size_t>(nz);
+    report.pointsFound = 0;
+    report.actualDataBytes = size - report.dataOffset;
+    report.expectedDataBytes = 0;
+    report.truncated = false;
+    report.malformed = false;
+    report.errorOffset = size;
+    report.anomalyCount = 0;
+
+    // Predict the data size from the first line if all its tokens share one width.
+    const char *firstLine = data + report.dataOffset;
+    const char *firstNl = static_cast<const char *>(std::memchr(firstLine, '\n', report.actualDataBytes));
+    int firstCount = expectedValuesOnLine(0, nz);
+    if (firstNl && firstCount > 0) {
+        size_t newlineBytes = (firstNl > firstLine && firstNl[-1] == '\r') ? 2 : 1;
+        size_t textBytes = static_cast<size_t>(firstNl - firstLine) + 1 - newlineBytes;
+        if (textBytes % static_cast<size_t>(firstCount) == 0) {
+            size_t width = textBytes / static_cast<size_t>(firstCount);
+            size_t linesPerRow = (static_cast<size_t>(nz) + 5) / 6;
+            size_t rowBytes = static_cast<size_t>(nz) * width + linesPerRow * newlineBytes;
+            size_t rows = static_cast<size_t>(report.header.dims[0]) * static_cast<size_t>(report.header.dims[1]);
+            report.expectedDataBytes = rows * rowBytes;
+        }
+    }
+
+    // Scan the data block line by line.
+    const char *p = firstLine;
+    const char *end = data + size;
+    size_t lineNumber = static_cast<size_t>(std::count(data, firstLine, '\n')) + 1;
+    size_t dataLine = 0;
+    while (p < end && !report.malformed) {
+        const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        const char *lineEnd = nl ? nl : end;
+        int found = 0;
+        const char *q = p;
+        while (q < lineEnd) {
+            while (q < lineEnd && isSpace(*q))
+                ++q;
+            if (q == lineEnd)
+                break;
+            const char *tokenEnd = q;
+            while (tokenEnd < lineEnd && !isSpace(*tokenEnd))
+                ++tokenEnd;
+            if (!isNumberToken(q, tokenEnd)) {
+                report.malformed = true;
+                report.errorOffset = static_cast<size_t>(q - data);
+                break;
+            }
+            ++found;
+            q = tokenEnd;
+        }
+        report.pointsFound += static_cast<size_t>(found);
+
+        // Trailing blank lines after a complete data block are not anomalies.
+        bool trailingBlank = (found == 0 && report.pointsFound >= report.expectedPoints);
+        if (!report.malformed && !trailingBlank) {
+            int expected = report.pointsFound - found < report.expectedPoints
+                               ? expectedValuesOnLine(dataLine, nz) : 0;
+            if (found != expected) {
+                if (report.lineAnomalies.size() < maxStoredAnomalies)
+                    report.lineAnomalies.push_back({lineNumber, static_cast<size_t>(p - data), expected, found});
+                ++report.anomalyCount;
+            }
+            if (found > 0)
+                ++dataLine;
+        }
+        p = nl ? nl + 1 : end;
+        ++lineNumber;
+    }
+
+    if (report.pointsFound < report.expectedPoints) {
+        report.truncated = true;
+        if (!report.malformed)
+            report.errorOffset = size;
+    }
+    return report;
+}
+
+// Write a CubeData structure as a text cube file.
+// Throws a runtime_error if the file cannot be written.
+void writeCubeFile(const CubeData &cube, const std::string &filename) {
+    std::FILE *out = std::fopen(filename.c_str(), "w");
+    if (!out)
+        throw std::runtime_error("Error opening file for writing: " + filename);
+    const CubeHeader &h = cube.header;
+    std::fprintf(out, "%s\n%s\n", h.comment1.c_str(), h.comment2.c_str());
+    std::fprintf(out, "%5d%12.6f%12.6f%12.6f\n", h.numAtoms, h.origin[0], h.origin[1], h.origin[2]);
+    for (int i = 0; i < 3; ++i)
+        std::fprintf(out, "%5d%12.6f%12.6f%12.6f\n", h.axisVectors[i][0] < 0 ? -h.dims[i] : h.dims[i],
+                     h.axisVectors[i][1], h.axisVectors[i][2], h.axisVectors[i][3]);
+    for (const auto &a : h.atoms)
+        std::fprintf(out, "%5d%12.6f%12.6f%12.6f%12.6f\n", a.atomicNumber, a.charge,
+                     a.position[0], a.position[1], a.position[2]);
+    if (h.calcType == "ORCA" || !h.extraLine.empty())
+        std::fprintf(out, "%s\n", h.extraLine.c_str());
+
+    // Values are written 6 per line, starting a new line at the end of each z-row.
+    const size_t nz = static_cast<size_t>(h.dims[2]);
+    for (size_t i = 0; i < cube.values.size(); ++i) {
+        std::fprintf(out, " %12.5E", cube.values[i]);
+        if ((i % nz) % 6 == 5 || i % nz == nz - 1)
+            std::fputc('\n', out);
+    }
+    if (std::fclose(out) != 0)
+        throw std::runtime_error("Error writing file: " + filename);
+}
+
 // Compute the voxel volume from the three axis vectors using the scalar triple product.
 // The voxel volume is given by |a · (b × c)|, where a, b, c are the step vectors.
 double computeVoxelVolume(const CubeHeader &header) {
@@ -144,13 +401,25 @@ double computeVoxelVolume(const CubeHeader &header) {
 //
 // detectAngstrom attempts to determine whether the cube file’s coordinates
 // are in Angstroms or in Bohr. It first searches for the keywords "angstrom" or "bohr"
-// in the first two comment lines. If not found, it uses a heuristic based on the average
-// length of the three axis vectors (if the average length > 2.0, assume Angstrom).
+// in the first two comment lines, then for a negative voxel count (the cube convention for
+// Angstrom), then applies the unit rule of the producer. If none decides, it uses a
+// heuristic based on the average length of the three axis vectors (if the average
+// length > 2.0, assume Angstrom).
 bool detectAngstrom(const CubeHeader &header) {
+    // Formats read by their own readers (VASP, XSF) are converted to bohr, whatever their
+    // titles say.
+    const CubeFormatDetector *format = findCubeFormat(header.calcType);
+    if (format && !format->matches && format->units == LengthUnitRule::Bohr)
+        return false;
     if (icontains(header.comment1, "angstrom") || icontains(header.comment2, "angstrom"))
         return true;
     if (icontains(header.comment1, "bohr") || icontains(header.comment2, "bohr"))
         return false;
+    for (int i = 0; i < 3; ++i)
+        if (header.axisVectors[i][0] < 0)
+            return true;
+    if (format && format->units == LengthUnitRule::Bohr)
+        return false;
     double totalLength = 0.0;
     for (int i = 0; i < 3; ++i) {
         double ax = header.axisVectors[i][1],
@@ -195,8 +464,15 @@ double convertOrbital(double nativeOrbital, bool nativeIsAngstrom) {
 // and then the square root is taken at the threshold.
 // These functions map a given percentage of the total integrated quantity to a threshold value (isovalue)
 // and also compute the percentage from a given isovalue.
+//
+// Threshold contract: the points are put in mass order (largest contribution first), and
+// the isovalue is the value of the first point at which the cumulative mass reaches the
+// target. The enclosed region {v : v >= isovalue} includes all points tied with it, so the
+// enclosed mass is always >= the target. Every sum is formed with the fixed blocking of
+// blockedSum (parallel.hpp), so results are bit-identical for any number of threads.
 
-double computeIsovalueFromPercentage_Density(const std::vector<double> &values, double percent, bool positive) {
+double computeIsovalueFromPercentage_Density(const std::vector<double> &values, double percent, bool positive,
+                                             bool interpolate) {
     // Filter the values by sign.
     std::vector<double> filtered;
     for (double v : values) {
@@ -205,46 +481,45 @@ double computeIsovalueFromPercentage_Density(const std::vector<double> &values,
     }
     if (filtered.empty())
         throw std::runtime_error("No grid points with the requested sign.");
+    // Sort by decreasing magnitude; negative values are integrated by magnitude, which
+    // is exact because negation does not round.
+    if (positive)
+        parallelSort(filtered, std::greater<double>());
+    else
+        parallelSort(filtered, std::less<double>());
+    auto mass = [&](size_t i) { return std::abs(filtered[i]); };
+    auto sameLevel = [&](size_t i, size_t j) { return filtered[i] == filtered[j]; };
     // Compute total integrated value.
-    double total = 0.0;
-    for (double v : filtered)
-        total += v;
+    double total = blockedSum(filtered.size(), mass);
     double target = (percent / 100.0) * total;
-    // Sort the filtered values.
-    if (positive) {
-        std::sort(filtered.begin(), filtered.end(), std::greater<double>());
-        double integ = 0.0;
-        for (double v : filtered) {
-            integ += v;
-            if (integ >= target)
-                return v;
-        }
-    }
-    else {
-        std::sort(filtered.begin(), filtered.end());
-        double integ = 0.0;
-        for (double v : filtered) {
-            integ += v;
-            if (integ <= target)
-                return v;
-        }
-    }
-    return filtered.back();
+    ThresholdCrossing c = findThresholdCrossing(filtered.size(), mass, sameLevel, target);
+    if (!interpolate || c.groupBegin == 0)
+        return filtered[c.index];
+    double level = interpolateLevel(std::abs(filtered[c.groupBegin - 1]), std::abs(filtered[c.index]), c, target);
+    return positive ? level : -level;
 }
 
-double computePercentageFromIsovalue_Density(const std::vector<double> &values, double isovalue, bool positive) {
-    double total = 0.0, integ = 0.0;
-    for (double v : values) {
-        if (positive && v > 0) {
-            total += v;
-            if (v >= isovalue)
-                integ += v;
-        }
-        else if (!positive && v < 0) {
-            total += v;
-            if (v <= isovalue)
-                integ += v;
-        }
+double computePercentageFromIsovalue_Density(const std::vector<double> &values, double isovalue, bool positive,
+                                             bool interpolate) {
+    auto selected = [&](double v) { return positive ? v > 0 : v < 0; };
+    double total = blockedSum(values.size(), [&](size_t i) {
+        return selected(values[i]) ? values[i] : 0.0;
+    });
+    double integ;
+    if (interpolate) {
+        // Work on magnitudes so both signs share one code path.
+        integ = interpolatedEnclosedMass(
+            values.size(), [&](size_t i) { return std::abs(values[i]); },
+            [&](size_t i) { return std::abs(values[i]); }, [&](size_t i) { return selected(values[i]); },
+            std::abs(isovalue));
+        if (!positive)
+            integ = -integ;
+    }
+    else {
+        integ = blockedSum(values.size(), [&](size_t i) {
+            double v = values[i];
+            return (selected(v) && (positive ? v >= isovalue : v <= isovalue)) ? v : 0.0;
+        });
     }
     if (total == 0.0)
         throw std::runtime_error("Total charge for the requested sign is zero.");
@@ -253,72 +528,380 @@ double computePercentageFromIsovalue_Density(const std::vector<double> &values,
 
 // For orbital data, we first square each grid value (to obtain orbital density),
 // then sort and accumulate these squared values. When the cumulative sum reaches the target,
-// we return the square root of the grid value (restoring the original orbital amplitude).
+// we return the grid value (restoring the original orbital amplitude).
+// If the crossing density level contains both signs, the positive amplitude is returned.
 struct OrbitalPoint {
     double density; // v^2
     double value;   // original grid value v
     size_t index;   // original grid index in the cube file
 };
 
-double computeIsovalueFromPercentage_Orbital(const std::vector<double> &values, double percent, bool /*positive*/) {
-    std::vector<OrbitalPoint> points;
+double computeIsovalueFromPercentage_Orbital(const std::vector<double> &values, double percent, bool /*positive*/,
+                                             bool interpolate) {
+    std::vector<OrbitalPoint> points(values.size());
     // Add all grid points for orbital data regardless of sign.
     for (size_t i = 0; i < values.size(); i++) {
         double v = values[i];
-        points.push_back({v * v, v, i});
+        points[i] = {v * v, v, i};
     }
     if (points.empty())
         throw std::runtime_error("No orbital grid points available.");
 
-    double total = 0.0;
-    for (const auto &p : points)
-        total += p.density;
+    // Sort the points in descending order by density (i.e. squared value), and by
+    // descending value within a density level, which makes the order total.
+    parallelSort(points, [](const OrbitalPoint &a, const OrbitalPoint &b) {
+        return a.density > b.density || (a.density == b.density && a.value > b.value);
+    });
+
+    auto mass = [&](size_t i) { return points[i].density; };
+    auto sameLevel = [&](size_t i, size_t j) { return points[i].density == points[j].density; };
+    double total = blockedSum(points.size(), mass);
     double target = (percent / 100.0) * total;
 
-    // Sort the points in descending order by density (i.e. squared value)
-    std::sort(points.begin(), points.end(), [](const OrbitalPoint &a, const OrbitalPoint &b) {
-        return a.density > b.density;
-    });
+    // Accumulate the squared values until reaching the target fraction, then return the
+    // amplitude at the start of the crossing density level.
+    ThresholdCrossing c = findThresholdCrossing(points.size(), mass, sameLevel, target);
+    double value = points[c.groupBegin].value;
+    if (!interpolate || c.groupBegin == 0)
+        return value;
+    // Interpolate the amplitude between the bracketing density levels.
+    double level = interpolateLevel(std::abs(points[c.groupBegin - 1].value), std::abs(value), c, target);
+    return value < 0 ? -level : level;
+}
+
 
-    // Print sorted output in a file matching OpenCubMan's format
-    /*std::ofstream debugFile("sorted_debug_finder.txt");
-    if (!debugFile) {
-        std::cerr << "Error: Unable to open file for writing sorted data." << std::endl;
+double computePercentageFromIsovalue_Orbital(const std::vector<double> &values, double isovalue, bool positive,
+                                             bool interpolate) {
+    double thresholdDensity = isovalue * isovalue;
+    double total = blockedSum(values.size(), [&](size_t i) { return values[i] * values[i]; });
+    double integ;
+    if (interpolate) {
+        integ = interpolatedEnclosedMass(
+            values.size(), [&](size_t i) { return std::abs(values[i]); },
+            [&](size_t i) { return values[i] * values[i]; }, [](size_t) { return true; },
+            std::abs(isovalue));
     }
     else {
-        debugFile << "Sorted list of grid point indices (i, |w|, d):" << std::endl;
-        for (size_t i = 0; i < points.size(); ++i) {
-            debugFile << i << ": index " << points[i].index
-                      << " |w| = " << fabs(points[i].value)
-                      << " d = " << points[i].density << std::endl;
+        integ = blockedSum(values.size(), [&](size_t i) {
+            double d = values[i] * values[i];
+            return d >= thresholdDensity ? d : 0.0;
+        });
+    }
+    if (total == 0.0)
+        throw std::runtime_error("Total orbital density for the requested sign is zero.");
+    return (integ / total) * 100.0;
+}
+
+std::vector<double> computePercentagesFromIsovalues(const std::vector<double> &values,
+                                                    const std::vector<double> &isovalues, bool orbital,
+                                                    bool positive) {
+    // Map values and thresholds to a common "larger is enclosed" key.
+    auto key = [&](double v) { return orbital ? v * v : (positive ? v : -v); };
+    auto selected = [&](double v) { return orbital || (positive ? v > 0 : v < 0); };
+    std::vector<double> thresholds;
+    for (double iso : isovalues)
+        thresholds.push_back(key(iso));
+    std::sort(thresholds.begin(), thresholds.end());
+
+    // bins[m]: mass of the points that reach exactly the m smallest thresholds.
+    const size_t binCount = thresholds.size() + 1;
+    const size_t blocks = (values.size() + reductionBlock - 1) / reductionBlock;
+    std::vector<double> partial(blocks * binCount, 0.0);
+    parallelFor(blocks, [&](size_t b) {
+        double *bins = &partial[b * binCount];
+        const size_t end = std::min(values.size(), (b + 1) * reductionBlock);
+        for (size_t i = b * reductionBlock; i < end; ++i) {
+            const double v = values[i];
+            if (!selected(v))
+                continue;
+            const double k = key(v);
+            size_t m = static_cast<size_t>(std::upper_bound(thresholds.begin(), thresholds.end(), k) -
+                                           thresholds.begin());
+            bins[m] += orbital ? k : std::abs(v);
         }
-        debugFile.close();
-    }*/
-
-    // Accumulate the squared values until reaching the target fraction.
-    double integ = 0.0;
-    for (const auto &p : points) {
-        integ += p.density;
-        if (integ >= target)
-            //return std::sqrt(p.density); // Return the square-rooted value.
-            return p.value; // Return the square-rooted value.
+    });
+    std::vector<double> bins(binCount, 0.0);
+    for (size_t b = 0; b < blocks; ++b)
+        for (size_t m = 0; m < binCount; ++m)
+            bins[m] += partial[b * binCount + m];
+
+    double total = 0.0;
+    for (double mass : bins)
+        total += mass;
+    if (total == 0.0)
+        throw std::runtime_error("Total charge for the requested sign is zero.");
+    // enclosed[k] = mass of the points reaching threshold k = sum of bins above k.
+    std::vector<double> enclosed(thresholds.size(), 0.0);
+    double running = 0.0;
+    for (size_t m = binCount - 1; m > 0; --m) {
+        running += bins[m];
+        enclosed[m - 1] = running;
+    }
+    std::vector<double> percentages;
+    for (double iso : isovalues) {
+        size_t k = static_cast<size_t>(std::lower_bound(thresholds.begin(), thresholds.end(), key(iso)) -
+                                       thresholds.begin());
+        percentages.push_back(enclosed[k] / total * 100.0);
     }
-    //return std::sqrt(points.back().density);
-    return points.back().value;
+    return percentages;
 }
 
+// ----- Sign-Resolved Orbital Analysis -----
+//
+// The grid is copied once into a buffer partitioned as [positive | negative | zero].
+// Each phase is sorted in place by decreasing amplitude, which yields the per-phase
+// results directly. The combined result walks both phases in merged order (density
+// descending, positive before negative within a level), which is the order used by
+// computeIsovalueFromPercentage_Orbital; the walk forms its sums with the same fixed
+// blocking, so the combined isovalue is bit-identical to that function.
 
-double computePercentageFromIsovalue_Orbital(const std::vector<double> &values, double isovalue, bool positive) {
-    double thresholdDensity = isovalue * isovalue;
-    double total = 0.0, integ = 0.0;
-    for (double v : values) {
+namespace {
+
+// Per-phase isovalue and enclosed percentage on a phase sorted by decreasing amplitude.
+OrbitalPhase analysePhase(const double *phase, size_t count, double percent, double totalMass,
+                          bool interpolate) {
+    OrbitalPhase r{0.0, 0.0, 0.0, 0.0};
+    if (count == 0)
+        return r;
+    auto mass = [&](size_t i) { return phase[i] * phase[i]; };
+    auto sameLevel = [&](size_t i, size_t j) { return phase[i] == phase[j]; };
+    double phaseTotal = blockedSum(count, mass);
+    double target = (percent / 100.0) * phaseTotal;
+    ThresholdCrossing c = findThresholdCrossing(count, mass, sameLevel, target);
+    r.isovalue = phase[c.index];
+    if (interpolate && c.groupBegin > 0) {
+        double level = interpolateLevel(std::abs(phase[c.groupBegin - 1]), std::abs(phase[c.index]), c, target);
+        r.isovalue = phase[c.index] < 0 ? -level : level;
+        r.enclosedPercent = percent;
+    }
+    else {
+        r.enclosedPercent = phaseTotal > 0.0 ? c.massThrough / phaseTotal * 100.0 : 0.0;
+    }
+    r.phasePercent = totalMass > 0.0 ? phaseTotal / totalMass * 100.0 : 0.0;
+    return r;
+}
+
+// Percentage of a phase's density enclosed by |psi| >= |isovalue|.
+double phaseEnclosedPercent(const double *phase, size_t count, double isovalue, bool interpolate) {
+    if (count == 0)
+        return 0.0;
+    auto mass = [&](size_t i) { return phase[i] * phase[i]; };
+    double phaseTotal = blockedSum(count, mass);
+    double a = std::abs(isovalue);
+    double integ = interpolate
+        ? interpolatedEnclosedMass(count, [&](size_t i) { return std::abs(phase[i]); }, mass,
+                                   [](size_t) { return true; }, a)
+        : blockedSum(count, [&](size_t i) { return std::abs(phase[i]) >= a ? mass(i) : 0.0; });
+    return phaseTotal > 0.0 ? integ / phaseTotal * 100.0 : 0.0;
+}
+
+} // namespace
+
+OrbitalPhaseReport computeOrbitalPhasesFromPercentage(const std::vector<double> &values, double percent,
+                                                      bool interpolate) {
+    if (values.empty())
+        throw std::runtime_error("No orbital grid points available.");
+    std::vector<double> buffer(values);
+    auto negBegin = std::partition(buffer.begin(), buffer.end(), [](double v) { return v > 0; });
+    auto zeroBegin = std::partition(negBegin, buffer.end(), [](double v) { return v < 0; });
+    const double *pos = buffer.data();
+    const size_t nPos = static_cast<size_t>(negBegin - buffer.begin());
+    const double *neg = buffer.data() + nPos;
+    const size_t nNeg = static_cast<size_t>(zeroBegin - negBegin);
+    const size_t count = buffer.size();
+
+    parallelSort(buffer.begin(), negBegin, std::greater<double>());
+    parallelSort(negBegin, zeroBegin, std::less<double>());
+
+    // Element k of the merged (combined) order; zeros come last.
+    size_t ip = 0, in = 0;
+    auto next = [&]() {
+        if (ip < nPos && (in >= nNeg || pos[ip] * pos[ip] >= neg[in] * neg[in]))
+            return pos[ip++];
+        if (in < nNeg)
+            return neg[in++];
+        return 0.0;
+    };
+
+    // First walk: the blocked total in merged order.
+    double prefix = 0.0, running = 0.0;
+    for (size_t k = 0; k < count; ++k) {
+        double v = next();
+        running += v * v;
+        if ((k + 1) % reductionBlock == 0 || k + 1 == count) {
+            prefix += running;
+            running = 0.0;
+        }
+    }
+    const double total = prefix;
+    const double target = (percent / 100.0) * total;
+
+    // Second walk: find the crossing and the cumulative mass around its level.
+    ip = in = 0;
+    prefix = running = 0.0;
+    ThresholdCrossing c{count - 1, 0, count, 0.0, total};
+    double levelValue = 0.0, levelDensity = -1.0, previousAmplitude = 0.0;
+    double cumulativeBefore = 0.0, lastCumulative = 0.0;
+    bool found = false, hasPrevious = false;
+    for (size_t k = 0; k < count; ++k) {
+        double v = next();
         double d = v * v;
-        total += d;
-        if (d >= thresholdDensity)
-            integ += d;
+        if (d != levelDensity) {
+            if (found) {
+                c.groupEnd = k;
+                c.massThrough = lastCumulative;
+                break;
+            }
+            hasPrevious = levelDensity >= 0.0;
+            previousAmplitude = std::abs(levelValue);
+            cumulativeBefore = lastCumulative;
+            levelDensity = d;
+            levelValue = v;
+            c.groupBegin = k;
+        }
+        running += d;
+        lastCumulative = prefix + running;
+        if (!found && lastCumulative >= target) {
+            found = true;
+            c.index = k;
+            c.massBefore = cumulativeBefore;
+        }
+        if ((k + 1) % reductionBlock == 0) {
+            prefix += running;
+            running = 0.0;
+        }
+        if (k + 1 == count) {
+            c.groupEnd = count;
+            c.massThrough = lastCumulative;
+            if (!found)
+                c.massBefore = cumulativeBefore;
         }
+    }
+
+    OrbitalPhaseReport report;
+    report.combined.isovalue = levelValue;
+    if (interpolate && hasPrevious) {
+        double level = interpolateLevel(previousAmplitude, std::abs(levelValue), c, target);
+        report.combined.isovalue = levelValue < 0 ? -level : level;
+    }
+    report.combined.enclosedPercent = total > 0.0
+        ? (interpolate && hasPrevious ? percent : c.massThrough / total * 100.0) : 0.0;
+    report.combined.phasePercent = 100.0;
+    report.combined.combinedEnclosedPercent = report.combined.enclosedPercent;
+
+    report.positive = analysePhase(pos, nPos, percent, total, interpolate);
+    report.negative = analysePhase(neg, nNeg, percent, total, interpolate);
+    report.positive.combinedEnclosedPercent = phaseEnclosedPercent(pos, nPos, report.combined.isovalue, interpolate);
+    report.negative.combinedEnclosedPercent = phaseEnclosedPercent(neg, nNeg, report.combined.isovalue, interpolate);
+    return report;
+}
+
+OrbitalPhaseReport computeOrbitalPhasesFromIsovalue(const std::vector<double> &values, double isovalue,
+                                                    bool interpolate) {
+    if (values.empty())
+        throw std::runtime_error("No orbital grid points available.");
+    double total = blockedSum(values.size(), [&](size_t i) { return values[i] * values[i]; });
+    double posTotal = blockedSum(values.size(), [&](size_t i) { return values[i] > 0 ? values[i] * values[i] : 0.0; });
+    double negTotal = blockedSum(values.size(), [&](size_t i) { return values[i] < 0 ? values[i] * values[i] : 0.0; });
     if (total == 0.0)
-        throw std::runtime_error("Total orbital density for the requested sign is zero.");
-    return (integ / total) * 100.0;
+        throw std::runtime_error("Total orbital density is zero.");
+    double a = std::abs(isovalue);
+    auto enclosed = [&](int sign) {
+        auto selected = [&](size_t i) { return sign == 0 || (sign > 0 ? values[i] > 0 : values[i] < 0); };
+        auto mass = [&](size_t i) { return values[i] * values[i]; };
+        if (interpolate)
+            return interpolatedEnclosedMass(values.size(), [&](size_t i) { return std::abs(values[i]); },
+                                            mass, selected, a);
+        return blockedSum(values.size(), [&](size_t i) {
+            return selected(i) && std::abs(values[i]) >= a ? mass(i) : 0.0;
+        });
+    };
+    OrbitalPhaseReport report;
+    report.combined = {a, enclosed(0) / total * 100.0, 100.0, 0.0};
+    report.positive = {a, posTotal > 0.0 ? enclosed(1) / posTotal * 100.0 : 0.0, posTotal / total * 100.0, 0.0};
+    report.negative = {-a, negTotal > 0.0 ? enclosed(-1) / negTotal * 100.0 : 0.0, negTotal / total * 100.0, 0.0};
+    report.combined.combinedEnclosedPercent = report.combined.enclosedPercent;
+    report.positive.combinedEnclosedPercent = report.positive.enclosedPercent;
+    report.negative.combinedEnclosedPercent = report.negative.enclosedPercent;
+    return report;
 }
 
+// ----- Spin Density Analysis -----
+
+namespace {
+
+// Isovalue and enclosed percentage of one sign, sorted by decreasing magnitude.
+SpinExcess analyseSpinExcess(const double *part, size_t count, double percent, bool interpolate) {
+    SpinExcess r{0.0, 0.0, 0.0};
+    if (count == 0)
+        return r;
+    auto mass = [&](size_t i) { return std::abs(part[i]); };
+    auto sameLevel = [&](size_t i, size_t j) { return part[i] == part[j]; };
+    double total = blockedSum(count, mass);
+    double target = (percent / 100.0) * total;
+    ThresholdCrossing c = findThresholdCrossing(count, mass, sameLevel, target);
+    r.isovalue = part[c.index];
+    r.enclosedPercent = c.massThrough / total * 100.0;
+    if (interpolate && c.groupBegin > 0) {
+        double level = interpolateLevel(std::abs(part[c.groupBegin - 1]), std::abs(part[c.index]), c, target);
+        r.isovalue = part[c.index] < 0 ? -level : level;
+        r.enclosedPercent = percent;
+    }
+    r.integral = part[0] < 0 ? -total : total;
+    return r;
+}
+
+} // namespace
+
+SpinDensityReport computeSpinDensityFromPercentage(const std::vector<double> &values, double percent,
+                                                   bool interpolate) {
+    std::vector<double> buffer(values);
+    auto negBegin = std::partition(buffer.begin(), buffer.end(), [](double v) { return v > 0; });
+    auto zeroBegin = std::partition(negBegin, buffer.end(), [](double v) { return v < 0; });
+    if (buffer.begin() == zeroBegin)
+        throw std::runtime_error("The spin density is zero everywhere.");
+    parallelSort(buffer.begin(), negBegin, std::greater<double>());
+    parallelSort(negBegin, zeroBegin, std::less<double>());
+
+    SpinDensityReport report;
+    report.alpha = analyseSpinExcess(buffer.data(), static_cast<size_t>(negBegin - buffer.begin()), percent,
+                                     interpolate);
+    report.beta = analyseSpinExcess(buffer.data() + (negBegin - buffer.begin()),
+                                    static_cast<size_t>(zeroBegin - negBegin), percent, interpolate);
+    report.net = report.alpha.integral + report.beta.integral;
+    report.absolute = report.alpha.integral - report.beta.integral;
+    return report;
+}
+
+SpinDensityReport computeSpinDensityFromIsovalue(const std::vector<double> &values, double isovalue,
+                                                 bool interpolate) {
+    const double a = std::abs(isovalue);
+    SpinDensityReport report;
+    report.alpha = {a, 0.0, blockedSum(values.size(), [&](size_t i) { return values[i] > 0 ? values[i] : 0.0; })};
+    report.beta = {-a, 0.0, blockedSum(values.size(), [&](size_t i) { return values[i] < 0 ? values[i] : 0.0; })};
+    if (report.alpha.integral == 0.0 && report.beta.integral == 0.0)
+        throw std::runtime_error("The spin density is zero everywhere.");
+    if (report.alpha.integral != 0.0)
+        report.alpha.enclosedPercent = computePercentageFromIsovalue_Density(values, a, true, interpolate);
+    if (report.beta.integral != 0.0)
+        report.beta.enclosedPercent = computePercentageFromIsovalue_Density(values, -a, false, interpolate);
+    report.net = report.alpha.integral + report.beta.integral;
+    report.absolute = report.alpha.integral - report.beta.integral;
+    return report;
+}
+
+// ----- Parse Throughput -----
+
+ParseBenchmark benchmarkCubeParse(const std::string &filename, int repetitions) {
+    MappedFile file(filename);
+    ParseBenchmark bench{file.size(), parseCubeData(file.data(), file.size()).values.size(),
+                         std::numeric_limits<double>::infinity(), 0.0};
+    for (int r = 0; r < repetitions; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        CubeData cube = parseCubeData(file.data(), file.size());
+        bench.bestSeconds = std::min(
+            bench.bestSeconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    bench.megabytesPerSecond = bench.bytes / bench.bestSeconds / 1e6;
+    return bench;
+}
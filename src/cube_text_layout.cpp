@@ -0,0 +1,354 @@
+/*
+ * CubeIsoFinder
+ * File: cube_text_layout.cpp
+ *
+ * Description:
+ *   Implements the fixed-width layout probe, row-parallel parsing, the row index and
+ *   random access to the values, slices and lines of text cube files.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "cube_text_layout.hpp"
+#include "parallel.hpp"
+#include "result_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+} // namespace
+
+bool parseFixedWidthField(const char *field, size_t width, double &value) {
+    const char *end = field + width;
+    if (width == 0 || (*field != ' ' && *field != '-' && *field != '+'))
+        return false;
+    while (field < end && *field == ' ')
+        ++field;
+    if (field < end && *field == '+' && ++field < end && *field == '-')
+        return false;
+    auto result = std::from_chars(field, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+bool parseCubeTextRows(const char *data, const CubeTextLayout &layout, size_t firstRow, size_t endRow,
+                       double *out) {
+    for (size_t row = firstRow; row < endRow; ++row) {
+        const char *p = data + layout.rowOffset(row);
+        double *values = out + (row - firstRow) * layout.rowLength;
+        for (size_t z = 0; z < layout.rowLength;) {
+            const size_t count = std::min(layout.valuesPerLine, layout.rowLength - z);
+            for (size_t k = 0; k < count; ++k, p += layout.fieldWidth)
+                if (!parseFixedWidthField(p, layout.fieldWidth, values[z + k]))
+                    return false;
+            if (layout.newlineBytes == 2 && *p++ != '\r')
+                return false;
+            if (*p++ != '\n')
+                return false;
+            z += count;
+        }
+    }
+    return true;
+}
+
+bool probeCubeTextLayout(const char *data, size_t size, const CubeHeader &header, size_t dataOffset,
+                         CubeTextLayout &layout) {
+    layout = CubeTextLayout();
+    if (dataOffset >= size || header.dims[0] <= 0 || header.dims[1] <= 0 || header.dims[2] <= 0)
+        return false;
+    layout.dataOffset = dataOffset;
+    layout.rowLength = static_cast<size_t>(header.dims[2]);
+    layout.rows = static_cast<size_t>(header.dims[0]) * static_cast<size_t>(header.dims[1]);
+
+    // Field width and line terminator from the first data line.
+    const char *first = data + dataOffset;
+    const char *nl = static_cast<const char *>(std::memchr(first, '\n', size - dataOffset));
+    if (!nl)
+        return false;
+    layout.newlineBytes = (nl > first && nl[-1] == '\r') ? 2 : 1;
+    const size_t textBytes = static_cast<size_t>(nl - first) + 1 - layout.newlineBytes;
+    const size_t firstCount = std::min(layout.valuesPerLine, layout.rowLength);
+    if (textBytes == 0 || textBytes % firstCount != 0)
+        return false;
+    layout.fieldWidth = textBytes / firstCount;
+    const size_t linesPerRow = (layout.rowLength + layout.valuesPerLine - 1) / layout.valuesPerLine;
+    layout.rowBytes = layout.rowLength * layout.fieldWidth + linesPerRow * layout.newlineBytes;
+
+    // The data block must have exactly the predicted size.
+    const size_t available = size - dataOffset;
+    if (layout.rowBytes > available / layout.rows)
+        return false;
+    for (size_t p = dataOffset + layout.rows * layout.rowBytes; p < size; ++p)
+        if (!isSpace(data[p]))
+            return false;
+
+    std::vector<double> scratch(layout.rowLength);
+    const size_t probeRows = std::min(layoutProbeRows, layout.rows);
+    for (size_t row = 0; row < probeRows; ++row)
+        if (!parseCubeTextRows(data, layout, row, row + 1, scratch.data()))
+            return false;
+    return parseCubeTextRows(data, layout, layout.rows - 1, layout.rows, scratch.data());
+}
+
+bool parseCubeTextParallel(const char *data, const CubeTextLayout &layout, std::vector<double> &out) {
+    out.resize(layout.rows * layout.rowLength);
+    const size_t tasks = std::min<size_t>(layout.rows, 8 * static_cast<size_t>(workerCount()));
+    const size_t rowsPerTask = (layout.rows + tasks - 1) / tasks;
+    std::atomic<bool> ok(true);
+    parallelFor(tasks, [&](size_t t) {
+        const size_t firstRow = t * rowsPerTask;
+        const size_t endRow = std::min(layout.rows, firstRow + rowsPerTask);
+        if (firstRow < endRow && ok &&
+            !parseCubeTextRows(data, layout, firstRow, endRow, out.data() + firstRow * layout.rowLength))
+            ok = false;
+    });
+    return ok;
+}
+
+// ----- Row Index -----
+
+namespace {
+
+const char rowIndexMagic[8] = {'C', 'I', 'F', 'R', 'O', 'W', 'S', '1'};
+
+// A cached row index is accepted only if it has the expected number of increasing offsets
+// within the file.
+bool readRowIndex(const std::string &path, size_t rows, size_t size, std::vector<uint64_t> &offsets) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(rowIndexMagic)];
+    uint64_t count = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, rowIndexMagic, sizeof(magic)) != 0 ||
+        !in.read(reinterpret_cast<char *>(&count), sizeof(count)) || count != rows)
+        return false;
+    offsets.resize(rows);
+    if (!in.read(reinterpret_cast<char *>(offsets.data()), static_cast<std::streamsize>(rows * sizeof(uint64_t))))
+        return false;
+    for (size_t r = 0; r < rows; ++r)
+        if (offsets[r] >= size || (r > 0 && offsets[r] <= offsets[r - 1]))
+            return false;
+    return true;
+}
+
+// Written to a temporary file and renamed, like the result cache; failures are ignored.
+void writeRowIndex(const std::string &directory, const std::string &path, const std::vector<uint64_t> &offsets) {
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    const std::string temporary = path + ".tmp" + std::to_string(std::random_device()());
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        const uint64_t count = offsets.size();
+        out.write(rowIndexMagic, sizeof(rowIndexMagic));
+        out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char *>(offsets.data()),
+                  static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temporary, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, path, ec);
+    if (ec)
+        std::filesystem::remove(temporary, ec);
+}
+
+} // namespace
+
+std::vector<uint64_t> buildCubeRowIndex(const char *data, size_t size, size_t dataOffset, size_t rowLength) {
+    std::vector<uint64_t> offsets;
+    size_t tokens = 0;
+    const char *p = data + std::min(dataOffset, size), *end = data + size;
+    while (true) {
+        while (p < end && isSpace(*p))
+            ++p;
+        if (p == end)
+            break;
+        if (tokens++ % rowLength == 0)
+            offsets.push_back(static_cast<uint64_t>(p - data));
+        while (p < end && !isSpace(*p))
+            ++p;
+    }
+    if (tokens % rowLength != 0)
+        offsets.pop_back(); // The last row is incomplete.
+    return offsets;
+}
+
+// ----- Random Access -----
+
+CubeTextFile::CubeTextFile(const std::string &filename, const std::string &cacheDirectory)
+    : filename_(filename), cacheDirectory_(cacheDirectory), file_(filename) {
+    header_ = parseCubeHeader(file_.data(), file_.size(), dataOffset_);
+    rowLength_ = static_cast<size_t>(header_.dims[2]);
+    rows_ = static_cast<size_t>(header_.dims[0]) * static_cast<size_t>(header_.dims[1]);
+    fixed_ = probeCubeTextLayout(file_.data(), file_.size(), header_, dataOffset_, layout_);
+}
+
+const std::vector<uint64_t> &CubeTextFile::rowOffsets() const {
+    if (!rowOffsets_.empty())
+        return rowOffsets_;
+    std::string path;
+    if (!cacheDirectory_.empty()) {
+        path = cacheDirectory_ + "/" + resultCacheKey(hashBytes(file_.data(), file_.size()), "row-index") + ".rows";
+        if (readRowIndex(path, rows_, file_.size(), rowOffsets_))
+            return rowOffsets_;
+    }
+    rowOffsets_ = buildCubeRowIndex(file_.data(), file_.size(), dataOffset_, rowLength_);
+    if (rowOffsets_.size() < rows_)
+        throw std::runtime_error("Error: " + filename_ + " holds only " + std::to_string(rowOffsets_.size()) +
+                                 " of " + std::to_string(rows_) + " rows.");
+    rowOffsets_.resize(rows_);
+    if (!path.empty())
+        writeRowIndex(cacheDirectory_, path, rowOffsets_);
+    return rowOffsets_;
+}
+
+double CubeTextFile::value(size_t index) const {
+    if (index >= rows_ * rowLength_)
+        throw std::runtime_error("Error: Grid index " + std::to_string(index) + " is out of range.");
+    if (!fixed_) {
+        // Parse the row up to the requested value.
+        const size_t row = index / rowLength_, z = index % rowLength_;
+        const char *p = file_.data() + rowOffsets()[row];
+        std::vector<double> values;
+        if (scanValues(p, file_.end(), values, z + 1) != z + 1)
+            throw std::runtime_error("Error: Malformed data in row " + std::to_string(row) + ".");
+        return values.back();
+    }
+    const size_t offset = layout_.valueOffset(index);
+    double v;
+    if (!parseFixedWidthField(file_.data() + offset, layout_.fieldWidth, v))
+        throw std::runtime_error("Error: Malformed value at byte offset " + std::to_string(offset) + ".");
+    return v;
+}
+
+double CubeTextFile::value(int x, int y, int z) const {
+    if (x < 0 || y < 0 || z < 0 || x >= header_.dims[0] || y >= header_.dims[1] || z >= header_.dims[2])
+        throw std::runtime_error("Error: Grid point (" + std::to_string(x) + ", " + std::to_string(y) + ", " +
+                                 std::to_string(z) + ") is out of range.");
+    return value((static_cast<size_t>(x) * header_.dims[1] + y) * header_.dims[2] + z);
+}
+
+void CubeTextFile::readRows(size_t firstRow, size_t count, double *out) const {
+    if (firstRow > rows_ || count > rows_ - firstRow)
+        throw std::runtime_error("Error: Rows " + std::to_string(firstRow) + " to " +
+                                 std::to_string(firstRow + count) + " are out of range.");
+    if (fixed_) {
+        if (!parseCubeTextRows(file_.data(), layout_, firstRow, firstRow + count, out))
+            throw std::runtime_error("Error: Malformed data in rows " + std::to_string(firstRow) + " to " +
+                                     std::to_string(firstRow + count) + ".");
+        return;
+    }
+    std::vector<double> values;
+    values.reserve(rowLength_);
+    for (size_t row = firstRow; row < firstRow + count; ++row) {
+        const char *p = file_.data() + rowOffsets()[row];
+        values.clear();
+        if (scanValues(p, file_.end(), values, rowLength_) != rowLength_)
+            throw std::runtime_error("Error: Malformed data in row " + std::to_string(row) + ".");
+        std::copy(values.begin(), values.end(), out + (row - firstRow) * rowLength_);
+    }
+}
+
+// ----- Slices and Lines -----
+
+namespace {
+
+// Adapts a loaded grid to the row interface of CubeTextFile.
+struct LoadedGrid {
+    const CubeData &cube;
+
+    const CubeHeader &header() const { return cube.header; }
+    double value(size_t index) const {
+        if (index >= cube.values.size())
+            throw std::runtime_error("Error: Grid index " + std::to_string(index) + " is out of range.");
+        return cube.values[index];
+    }
+    void readRows(size_t firstRow, size_t count, double *out) const {
+        const size_t nz = static_cast<size_t>(cube.header.dims[2]);
+        if ((firstRow + count) * nz > cube.values.size())
+            throw std::runtime_error("Error: Rows " + std::to_string(firstRow) + " to " +
+                                     std::to_string(firstRow + count) + " are out of range.");
+        std::copy(cube.values.begin() + firstRow * nz, cube.values.begin() + (firstRow + count) * nz, out);
+    }
+};
+
+void checkIndex(const CubeHeader &header, int axis, int index) {
+    static const char names[] = "xyz";
+    if (axis < 0 || axis > 2)
+        throw std::runtime_error("Error: Invalid axis " + std::to_string(axis) + ".");
+    if (index < 0 || index >= header.dims[axis])
+        throw std::runtime_error(std::string("Error: Index ") + std::to_string(index) + " on the " + names[axis] +
+                                 " axis is out of range (0 to " + std::to_string(header.dims[axis] - 1) + ").");
+}
+
+// Rows hold the z-values of one (x, y), so an x-plane is a run of rows, a y-plane one row
+// per x and a z-plane one value per row.
+template <typename Grid>
+std::vector<double> slice(const Grid &grid, int axis, int k) {
+    const CubeHeader &h = grid.header();
+    checkIndex(h, axis, k);
+    const size_t nx = h.dims[0], ny = h.dims[1], nz = h.dims[2];
+    std::vector<double> plane;
+    if (axis == 0) {
+        plane.resize(ny * nz);
+        grid.readRows(k * ny, ny, plane.data());
+    }
+    else if (axis == 1) {
+        plane.resize(nx * nz);
+        for (size_t x = 0; x < nx; ++x)
+            grid.readRows(x * ny + k, 1, plane.data() + x * nz);
+    }
+    else {
+        plane.resize(nx * ny);
+        for (size_t row = 0; row < nx * ny; ++row)
+            plane[row] = grid.value(row * nz + k);
+    }
+    return plane;
+}
+
+template <typename Grid>
+std::vector<double> line(const Grid &grid, int axis, int a, int b) {
+    const CubeHeader &h = grid.header();
+    const int first = axis == 0 ? 1 : 0, second = axis == 2 ? 1 : 2;
+    checkIndex(h, axis, 0);
+    checkIndex(h, first, a);
+    checkIndex(h, second, b);
+    const size_t ny = h.dims[1], nz = h.dims[2];
+    std::vector<double> values(h.dims[axis]);
+    if (axis == 2) {
+        grid.readRows(static_cast<size_t>(a) * ny + b, 1, values.data());
+    }
+    else {
+        for (size_t t = 0; t < values.size(); ++t) {
+            const size_t x = axis == 0 ? t : a, y = axis == 0 ? a : t;
+            values[t] = grid.value((x * ny + y) * nz + b);
+        }
+    }
+    return values;
+}
+
+} // namespace
+
+std::vector<double> extractSlice(const CubeTextFile &file, int axis, int k) { return slice(file, axis, k); }
+
+std::vector<double> extractLine(const CubeTextFile &file, int axis, int a, int b) { return line(file, axis, a, b); }
+
+std::vector<double> extractSlice(const CubeData &cube, int axis, int k) { return slice(LoadedGrid{cube}, axis, k); }
+
+std::vector<double> extractLine(const CubeData &cube, int axis, int a, int b) {
+    return line(LoadedGrid{cube}, axis, a, b);
+}
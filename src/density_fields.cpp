@@ -0,0 +1,182 @@
+/*
+ * CubeIsoFinder
+ * File: density_fields.cpp
+ *
+ * Description:
+ *   Implements the finite-difference gradient, Laplacian and reduced density gradient.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "density_fields.hpp"
+#include "grid_layout.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// Neighbour indices of every grid index along one axis. First derivatives use
+// (v[upper] - v[lower]) * inverseSpan; second derivatives use the three points
+// centre - 1, centre, centre + 1 (centre is moved inwards at open boundaries).
+struct AxisStencil {
+    std::vector<int> lower, upper, centreLower, centre, centreUpper;
+    std::vector<double> inverseSpan;
+};
+
+AxisStencil buildAxisStencil(int n, bool periodic) {
+    AxisStencil s;
+    s.lower.resize(n);
+    s.upper.resize(n);
+    s.centreLower.resize(n);
+    s.centre.resize(n);
+    s.centreUpper.resize(n);
+    s.inverseSpan.resize(n);
+    for (int i = 0; i < n; ++i) {
+        if (n < 3) {
+            // Too few points for a derivative; all terms vanish.
+            s.lower[i] = s.upper[i] = s.centreLower[i] = s.centre[i] = s.centreUpper[i] = i;
+            s.inverseSpan[i] = 0.0;
+            continue;
+        }
+        if (periodic) {
+            s.lower[i] = (i + n - 1) % n;
+            s.upper[i] = (i + 1) % n;
+            s.centre[i] = i;
+        }
+        else {
+            s.lower[i] = i > 0 ? i - 1 : 0;
+            s.upper[i] = i + 1 < n ? i + 1 : n - 1;
+            s.centre[i] = i < 1 ? 1 : (i > n - 2 ? n - 2 : i);
+        }
+        s.inverseSpan[i] = periodic ? 0.5 : 1.0 / (s.upper[i] - s.lower[i]);
+        s.centreLower[i] = periodic ? s.lower[i] : s.centre[i] - 1;
+        s.centreUpper[i] = periodic ? s.upper[i] : s.centre[i] + 1;
+    }
+    return s;
+}
+
+} // namespace
+
+DensityFields computeDensityFields(const CubeData &cube, bool periodic, const DensityFieldSelection &selection) {
+    const CubeHeader &h = cube.header;
+    const int nx = h.dims[0], ny = h.dims[1], nz = h.dims[2];
+    const size_t total = static_cast<size_t>(nx) * ny * nz;
+    if (cube.values.size() != total)
+        throw std::runtime_error("Derived fields require a complete grid.");
+
+    // A holds the step vectors as rows, so d rho / d i_p = a_p . grad rho, i.e. g = A grad.
+    // Hence grad = B g with B = A^-1, and the Laplacian is sum_pq G_pq d2 rho / d i_p d i_q
+    // with the inverse metric G = B^T B.
+    double a[3][3];
+    for (int p = 0; p < 3; ++p)
+        for (int k = 0; k < 3; ++k)
+            a[p][k] = h.axisVectors[p][k + 1];
+    double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+                 a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+                 a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    if (std::abs(det) < 1e-300)
+        throw std::runtime_error("Grid axis vectors are linearly dependent.");
+    double b[3][3];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c) {
+            // Cofactor of a[c][r] divided by the determinant.
+            int r1 = (c + 1) % 3, r2 = (c + 2) % 3, c1 = (r + 1) % 3, c2 = (r + 2) % 3;
+            b[r][c] = (a[r1][c1] * a[r2][c2] - a[r1][c2] * a[r2][c1]) / det;
+        }
+    double g[3][3];
+    for (int p = 0; p < 3; ++p)
+        for (int q = 0; q < 3; ++q)
+            g[p][q] = b[0][p] * b[0][q] + b[1][p] * b[1][q] + b[2][p] * b[2][q];
+    // Mixed terms vanish on orthogonal grids; skip them there.
+    const double diagonalScale = std::abs(g[0][0]) + std::abs(g[1][1]) + std::abs(g[2][2]);
+    const bool mixed = std::abs(g[0][1]) + std::abs(g[0][2]) + std::abs(g[1][2]) > 1e-12 * diagonalScale;
+
+    const AxisStencil sx = buildAxisStencil(nx, periodic);
+    const AxisStencil sy = buildAxisStencil(ny, periodic);
+    const AxisStencil sz = buildAxisStencil(nz, periodic);
+
+    DensityFields fields;
+    if (selection.gradient)
+        for (auto &component : fields.gradient)
+            component.resize(total);
+    if (selection.laplacian)
+        fields.laplacian.resize(total);
+    if (selection.reducedGradient)
+        fields.reducedGradient.resize(total);
+
+    const LinearGrid rho{cube.values.data(), {nx, ny, nz}};
+    constexpr double pi = 3.14159265358979323846;
+    const double rdgScale = 2.0 * std::cbrt(3.0 * pi * pi);
+    const double infinity = std::numeric_limits<double>::infinity();
+
+    // Each task fills one x-plane; z is the contiguous inner loop.
+    parallelFor(static_cast<size_t>(nx), [&](size_t xi) {
+        const int x = static_cast<int>(xi);
+        const int xl = sx.lower[x], xu = sx.upper[x];
+        const int xcl = sx.centreLower[x], xc = sx.centre[x], xcu = sx.centreUpper[x];
+        for (int y = 0; y < ny; ++y) {
+            const int yl = sy.lower[y], yu = sy.upper[y];
+            const int ycl = sy.centreLower[y], yc = sy.centre[y], ycu = sy.centreUpper[y];
+            const size_t row = (static_cast<size_t>(x) * ny + y) * nz;
+            for (int z = 0; z < nz; ++z) {
+                const int zl = sz.lower[z], zu = sz.upper[z];
+                const double d[3] = {(rho.at(xu, y, z) - rho.at(xl, y, z)) * sx.inverseSpan[x],
+                                     (rho.at(x, yu, z) - rho.at(x, yl, z)) * sy.inverseSpan[y],
+                                     (rho.at(x, y, zu) - rho.at(x, y, zl)) * sz.inverseSpan[z]};
+                double norm2 = 0.0;
+                for (int k = 0; k < 3; ++k) {
+                    double component = b[k][0] * d[0] + b[k][1] * d[1] + b[k][2] * d[2];
+                    if (selection.gradient)
+                        fields.gradient[k][row + z] = component;
+                    norm2 += component * component;
+                }
+                if (selection.reducedGradient) {
+                    const double v = rho.at(x, y, z);
+                    fields.reducedGradient[row + z] =
+                        v > 0.0 ? std::sqrt(norm2) / (rdgScale * std::pow(v, 4.0 / 3.0)) : infinity;
+                }
+                if (!selection.laplacian)
+                    continue;
+                double lap = 0.0;
+                if (nx >= 3)
+                    lap += g[0][0] * (rho.at(xcu, y, z) - 2.0 * rho.at(xc, y, z) + rho.at(xcl, y, z));
+                if (ny >= 3)
+                    lap += g[1][1] * (rho.at(x, ycu, z) - 2.0 * rho.at(x, yc, z) + rho.at(x, ycl, z));
+                if (nz >= 3)
+                    lap += g[2][2] * (rho.at(x, y, sz.centreUpper[z]) - 2.0 * rho.at(x, y, sz.centre[z]) +
+                                      rho.at(x, y, sz.centreLower[z]));
+                if (mixed) {
+                    double dxy = (rho.at(xu, yu, z) - rho.at(xu, yl, z) - rho.at(xl, yu, z) + rho.at(xl, yl, z)) *
+                                 sx.inverseSpan[x] * sy.inverseSpan[y];
+                    double dxz = (rho.at(xu, y, zu) - rho.at(xu, y, zl) - rho.at(xl, y, zu) + rho.at(xl, y, zl)) *
+                                 sx.inverseSpan[x] * sz.inverseSpan[z];
+                    double dyz = (rho.at(x, yu, zu) - rho.at(x, yu, zl) - rho.at(x, yl, zu) + rho.at(x, yl, zl)) *
+                                 sy.inverseSpan[y] * sz.inverseSpan[z];
+                    lap += 2.0 * (g[0][1] * dxy + g[0][2] * dxz + g[1][2] * dyz);
+                }
+                fields.laplacian[row + z] = lap;
+            }
+        }
+    });
+    return fields;
+}
+
+std::vector<double> maskByReducedGradient(const std::vector<double> &values, const DensityFields &fields,
+                                          double maxReducedGradient) {
+    if (fields.reducedGradient.size() != values.size())
+        throw std::runtime_error("Reduced gradient field does not match the grid.");
+    std::vector<double> masked(values.size());
+    parallelFor((values.size() + reductionBlock - 1) / reductionBlock, [&](size_t block) {
+        size_t end = std::min(values.size(), (block + 1) * reductionBlock);
+        for (size_t i = block * reductionBlock; i < end; ++i)
+            masked[i] = fields.reducedGradient[i] < maxReducedGradient ? values[i] : 0.0;
+    });
+    return masked;
+}
@@ -0,0 +1,312 @@
+/*
+ * CubeIsoFinder
+ * File: distributed.cpp
+ *
+ * Description:
+ *   Implements slab loading and the distributed threshold search.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "distributed.hpp"
+#include "cube_binary.hpp"
+#include "parallel.hpp"
+#include "streaming.hpp"
+#include "volumetric_formats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// Applies op to the contributions of all processes, element-wise and in rank order.
+template <typename Op>
+std::vector<double> reduce(ProcessGroup &group, const std::vector<double> &local, Op op) {
+    std::vector<double> all = group.allGather(local);
+    std::vector<double> result(local.size());
+    for (size_t k = 0; k < local.size(); ++k) {
+        result[k] = all[k];
+        for (int r = 1; r < group.size(); ++r)
+            result[k] = op(result[k], all[r * local.size() + k]);
+    }
+    return result;
+}
+
+uint64_t toBits(double v) {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+double fromBits(uint64_t bits) {
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Grid values are mapped to positive keys in mass order: v for positive density, -v for
+// negative density and v^2 for orbitals; values of the other sign (and zeros) have no key.
+struct KeyedSlab {
+    const std::vector<double> &values;
+    bool orbital;
+    bool positive;
+
+    double key(double v) const {
+        if (orbital)
+            return v * v;
+        return positive ? (v > 0 ? v : 0.0) : (v < 0 ? -v : 0.0);
+    }
+    double mass(double v) const { return orbital ? v * v : std::abs(v); }
+
+    // Quantity of the points whose key is at least level (level > 0).
+    double massAtLeast(double level) const {
+        return blockedSum(values.size(), [&](size_t i) { return key(values[i]) >= level ? mass(values[i]) : 0.0; });
+    }
+
+    // Counts followed by quantities of the keys with bit patterns in [lo, hi], in
+    // histogramBins bins of the given width. Chunks of histogramChunk values are binned in
+    // parallel and added in chunk order, so the result does not depend on the thread count.
+    std::vector<double> histogram(uint64_t lo, uint64_t hi, uint64_t width) const {
+        const size_t histogramChunk = 1 << 20;
+        const size_t chunks = (values.size() + histogramChunk - 1) / histogramChunk;
+        std::vector<double> hist(2 * histogramBins, 0.0);
+        const size_t wave = workerCount();
+        std::vector<std::vector<double>> partial(wave);
+        for (size_t c0 = 0; c0 < chunks; c0 += wave) {
+            const size_t n = std::min(wave, chunks - c0);
+            parallelFor(n, [&](size_t t) {
+                std::vector<double> &h = partial[t];
+                h.assign(2 * histogramBins, 0.0);
+                const size_t begin = (c0 + t) * histogramChunk;
+                const size_t end = std::min(values.size(), begin + histogramChunk);
+                for (size_t i = begin; i < end; ++i) {
+                    const double k = key(values[i]);
+                    const uint64_t bits = toBits(k);
+                    if (k == 0.0 || bits < lo || bits > hi)
+                        continue;
+                    const size_t b = static_cast<size_t>((bits - lo) / width);
+                    h[b] += 1.0;
+                    h[histogramBins + b] += mass(values[i]);
+                }
+            });
+            for (size_t t = 0; t < n; ++t)
+                for (size_t b = 0; b < hist.size(); ++b)
+                    hist[b] += partial[t][b];
+        }
+        return hist;
+    }
+};
+
+} // namespace
+
+std::vector<double> ProcessGroup::allGatherVariable(const std::vector<double> &local) {
+    std::vector<double> sizes = allGather({static_cast<double>(local.size())});
+    size_t longest = 0;
+    for (double n : sizes)
+        longest = std::max(longest, static_cast<size_t>(n));
+    std::vector<double> padded(local);
+    padded.resize(longest);
+    std::vector<double> all = allGather(padded);
+    std::vector<double> result;
+    for (size_t r = 0; r < sizes.size(); ++r)
+        result.insert(result.end(), all.begin() + r * longest, all.begin() + r * longest + static_cast<size_t>(sizes[r]));
+    return result;
+}
+
+std::vector<double> ProcessGroup::sum(const std::vector<double> &local) {
+    return reduce(*this, local, [](double a, double b) { return a + b; });
+}
+
+std::vector<double> ProcessGroup::min(const std::vector<double> &local) {
+    return reduce(*this, local, [](double a, double b) { return std::min(a, b); });
+}
+
+std::vector<double> ProcessGroup::max(const std::vector<double> &local) {
+    return reduce(*this, local, [](double a, double b) { return std::max(a, b); });
+}
+
+#ifndef CUBEISOFINDER_WITH_MPI
+std::unique_ptr<ProcessGroup> createMpiProcessGroup(int &, char **&) {
+    throw std::runtime_error("This build has no MPI support; configure with -DCUBEISOFINDER_MPI=ON.");
+}
+#endif
+
+GridSlab loadGridSlab(const std::string &filename, int part, int parts, bool allowTruncated) {
+    GridSlab slab;
+    const VolumetricFormat format = detectVolumetricFormat(filename);
+    // CHGCAR and XSF grids are converted on load, so they are read whole and sliced.
+    CubeData whole;
+    if (format == VolumetricFormat::CubeBinary) {
+        slab.header = readCubeBinaryInfo(filename).header;
+    }
+    else if (format == VolumetricFormat::Cube) {
+        CubeValueStream stream(filename);
+        slab.header = stream.header();
+    }
+    else {
+        whole = loadCube(filename, allowTruncated);
+        slab.header = whole.header;
+    }
+    const int nx = slab.header.dims[0];
+    const size_t plane = static_cast<size_t>(slab.header.dims[1]) * slab.header.dims[2];
+    const int firstPlane = static_cast<int>(static_cast<int64_t>(nx) * part / parts);
+    const int endPlane = static_cast<int>(static_cast<int64_t>(nx) * (part + 1) / parts);
+    slab.firstIndex = firstPlane * plane;
+    const size_t endIndex = endPlane * plane;
+
+    if (format == VolumetricFormat::CubeBinary) {
+        if (endPlane > firstPlane)
+            slab.values = readCubeBinarySlab(filename, firstPlane, endPlane - firstPlane);
+        return slab;
+    }
+    if (format != VolumetricFormat::Cube) {
+        const size_t begin = std::min(slab.firstIndex, whole.values.size());
+        const size_t end = std::min(endIndex, whole.values.size());
+        slab.values.assign(whole.values.begin() + begin, whole.values.begin() + end);
+        return slab;
+    }
+    slab.values.reserve(endIndex - slab.firstIndex);
+    CubeValueStream stream(filename);
+    stream.run(
+        [&](const double *values, size_t count, size_t firstIndex) {
+            const size_t begin = std::max(firstIndex, slab.firstIndex);
+            const size_t end = std::min(firstIndex + count, endIndex);
+            if (begin < end)
+                slab.values.insert(slab.values.end(), values + (begin - firstIndex), values + (end - firstIndex));
+        },
+        allowTruncated);
+    return slab;
+}
+
+DistributedResult distributedIsovalueFromPercentage(const GridSlab &slab, ProcessGroup &group, double percent,
+                                                    bool positive) {
+    const bool orbital = slab.header.isOrbital;
+    const KeyedSlab keyed{slab.values, orbital, positive};
+
+    double localMax = 0.0;
+    for (double v : slab.values)
+        localMax = std::max(localMax, keyed.key(v));
+    const double maxKey = group.max({localMax})[0];
+    if (maxKey == 0.0)
+        throw std::runtime_error(orbital ? "The orbital is zero everywhere." : "No grid points with the requested sign.");
+
+    DistributedResult result;
+    result.points = static_cast<size_t>(group.sum({static_cast<double>(slab.values.size())})[0]);
+
+    // Positive doubles are ordered like their bit patterns. [lo, hi] is the key range that
+    // contains the crossing; massAbove is the quantity of the keys above it.
+    uint64_t lo = toBits(std::numeric_limits<double>::denorm_min()), hi = toBits(maxKey);
+    double massAbove = 0.0, target = 0.0, bandMass = 0.0;
+    bool first = true;
+    while (true) {
+        const uint64_t width = (hi - lo) / histogramBins + 1;
+        std::vector<double> hist = group.sum(keyed.histogram(lo, hi, width));
+        const double *count = hist.data(), *mass = hist.data() + histogramBins;
+        if (first) {
+            result.total = 0.0;
+            for (size_t b = histogramBins; b-- > 0;)
+                result.total += mass[b];
+            target = (percent / 100.0) * result.total;
+            first = false;
+        }
+        // Walk down from the highest bin to the bin where the target is reached (the lowest
+        // occupied bin if rounding keeps the sum just below the target).
+        size_t selected = histogramBins;
+        for (size_t b = histogramBins; b-- > 0;) {
+            if (count[b] == 0.0)
+                continue;
+            selected = b;
+            if (massAbove + mass[b] >= target)
+                break;
+            massAbove += mass[b];
+        }
+        if (massAbove + mass[selected] < target)
+            massAbove -= mass[selected];
+        lo += selected * width;
+        hi = std::min(hi, lo + width - 1);
+        bandMass = mass[selected];
+        if (count[selected] <= candidateLimit || lo == hi)
+            break;
+    }
+
+    double level = fromBits(lo);
+    double enclosed = massAbove + bandMass;
+    double localPositive = -1.0, localNegative = -1.0;
+    if (lo != hi) {
+        // Locate the crossing among the gathered candidates, in mass order (positive
+        // amplitudes first within an orbital level).
+        std::vector<double> local;
+        for (double v : slab.values) {
+            const uint64_t bits = toBits(keyed.key(v));
+            if (keyed.key(v) > 0.0 && bits >= lo && bits <= hi)
+                local.push_back(v);
+        }
+        std::vector<double> candidates = group.allGatherVariable(local);
+        std::sort(candidates.begin(), candidates.end(), [&](double a, double b) {
+            const double ka = keyed.key(a), kb = keyed.key(b);
+            return ka != kb ? ka > kb : a > b;
+        });
+        double cumulative = massAbove;
+        size_t groupBegin = 0;
+        for (size_t begin = 0; begin < candidates.size();) {
+            size_t end = begin;
+            const double key = keyed.key(candidates[begin]);
+            while (end < candidates.size() && keyed.key(candidates[end]) == key)
+                cumulative += keyed.mass(candidates[end++]);
+            groupBegin = begin;
+            level = key;
+            enclosed = cumulative;
+            if (cumulative >= target)
+                break;
+            begin = end;
+        }
+        const double v = candidates[groupBegin];
+        (v > 0 ? localPositive : localNegative) = std::abs(v);
+    }
+    else {
+        // A single level: only its sign is needed.
+        for (double v : slab.values) {
+            if (keyed.key(v) != level)
+                continue;
+            if (v > 0)
+                localPositive = std::max(localPositive, v);
+            else
+                localNegative = std::max(localNegative, -v);
+        }
+        std::vector<double> found = group.max({localPositive, localNegative});
+        localPositive = found[0];
+        localNegative = found[1];
+    }
+    result.percentage = enclosed / result.total * 100.0;
+    if (orbital)
+        result.isovalue = localPositive > 0 ? localPositive : -localNegative;
+    else
+        result.isovalue = positive ? level : -level;
+    return result;
+}
+
+DistributedResult distributedPercentageFromIsovalue(const GridSlab &slab, ProcessGroup &group, double isovalue,
+                                                    bool positive) {
+    const bool orbital = slab.header.isOrbital;
+    const KeyedSlab keyed{slab.values, orbital, positive};
+    const double smallest = std::numeric_limits<double>::denorm_min();
+    // Same selection as the single-process functions: v >= isovalue, v <= isovalue or v^2 >= isovalue^2.
+    const double level = std::max(smallest, orbital ? isovalue * isovalue : (positive ? isovalue : -isovalue));
+
+    DistributedResult result;
+    result.points = static_cast<size_t>(group.sum({static_cast<double>(slab.values.size())})[0]);
+    std::vector<double> sums = group.sum({keyed.massAtLeast(smallest), keyed.massAtLeast(level)});
+    result.total = sums[0];
+    result.isovalue = isovalue;
+    if (result.total == 0.0)
+        throw std::runtime_error(orbital ? "The orbital is zero everywhere." : "No grid points with the requested sign.");
+    result.percentage = sums[1] / result.total * 100.0;
+    return result;
+}
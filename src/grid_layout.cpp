@@ -0,0 +1,184 @@
+/*
+ * CubeIsoFinder
+ * File: grid_layout.cpp
+ *
+ * Description:
+ *   Implements the stencil layout benchmark and the bricked layout it compares against.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "grid_layout.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// The grid as 8 x 8 x 8 bricks; bricks at the upper edges are padded.
+class BrickedGrid {
+public:
+    static constexpr int brickBits = 3;
+    static constexpr int brickSize = 1 << brickBits; // 8 voxels per brick edge.
+    static constexpr int brickVolume = brickSize * brickSize * brickSize;
+
+    // Convert from the flat x-major layout; bricks are filled in parallel.
+    BrickedGrid(const std::vector<double> &values, const int dims[3]);
+
+    double at(int x, int y, int z) const { return data_[index(x, y, z)]; }
+
+    size_t index(int x, int y, int z) const {
+        size_t brick = (static_cast<size_t>(x >> brickBits) * bricks_[1] + (y >> brickBits)) * bricks_[2] +
+                       (z >> brickBits);
+        int local = (((x & (brickSize - 1)) << brickBits | (y & (brickSize - 1))) << brickBits) |
+                    (z & (brickSize - 1));
+        return brick * brickVolume + static_cast<size_t>(local);
+    }
+
+    const int *brickCounts() const { return bricks_; }
+    // The 512 values of brick (bx, by, bz), ordered x, y, z (z fastest).
+    const double *brick(int bx, int by, int bz) const {
+        return data_.data() + ((static_cast<size_t>(bx) * bricks_[1] + by) * bricks_[2] + bz) * brickVolume;
+    }
+
+    int dims[3];
+
+private:
+    int bricks_[3];
+    std::vector<double> data_;
+};
+
+BrickedGrid::BrickedGrid(const std::vector<double> &values, const int gridDims[3]) {
+    for (int a = 0; a < 3; ++a) {
+        dims[a] = gridDims[a];
+        bricks_[a] = (gridDims[a] + brickSize - 1) / brickSize;
+    }
+    if (values.size() != static_cast<size_t>(dims[0]) * dims[1] * dims[2])
+        throw std::runtime_error("Grid size does not match the dimensions.");
+    data_.assign(static_cast<size_t>(bricks_[0]) * bricks_[1] * bricks_[2] * brickVolume, 0.0);
+    // Each task copies one x-slab of bricks; z-runs are contiguous in both layouts.
+    parallelFor(static_cast<size_t>(bricks_[0]), [&](size_t bx) {
+        int x0 = static_cast<int>(bx) * brickSize;
+        int x1 = std::min(dims[0], x0 + brickSize);
+        for (int x = x0; x < x1; ++x)
+            for (int y = 0; y < dims[1]; ++y) {
+                const double *row = values.data() + (static_cast<size_t>(x) * dims[1] + y) * dims[2];
+                for (int z0 = 0; z0 < dims[2]; z0 += brickSize) {
+                    int n = std::min(brickSize, dims[2] - z0);
+                    std::copy(row + z0, row + z0 + n, data_.begin() + index(x, y, z0));
+                }
+            }
+    });
+}
+
+template <typename Grid>
+double stencilAt(const Grid &g, int x, int y, int z) {
+    return g.at(x - 1, y, z) + g.at(x + 1, y, z) + g.at(x, y - 1, z) + g.at(x, y + 1, z) +
+           g.at(x, y, z - 1) + g.at(x, y, z + 1) - 6.0 * g.at(x, y, z);
+}
+
+// Apply the stencil to all interior voxels of the x-range [x0, x1) in flat order.
+double linearStencil(const LinearGrid &g, int x0, int x1) {
+    double s = 0.0;
+    for (int x = std::max(x0, 1); x < std::min(x1, g.dims[0] - 1); ++x)
+        for (int y = 1; y < g.dims[1] - 1; ++y)
+            for (int z = 1; z < g.dims[2] - 1; ++z)
+                s += std::abs(stencilAt(g, x, y, z));
+    return s;
+}
+
+// Apply the stencil to all interior voxels of one brick. The brick is processed in z-rows
+// of 8 values: the four x/y-neighbour rows are resolved once per row (inside this brick
+// or in the adjacent one), so the inner loop over z is branch-free; only the two end
+// values of a row read their z-neighbour from the adjacent brick.
+double brickStencil(const BrickedGrid &g, int bx, int by, int bz) {
+    const int b = BrickedGrid::brickSize;
+    const int *nb = g.brickCounts();
+    const double *d = g.brick(bx, by, bz);
+    const double *xLower = bx > 0 ? g.brick(bx - 1, by, bz) : d;
+    const double *xUpper = bx + 1 < nb[0] ? g.brick(bx + 1, by, bz) : d;
+    const double *yLower = by > 0 ? g.brick(bx, by - 1, bz) : d;
+    const double *yUpper = by + 1 < nb[1] ? g.brick(bx, by + 1, bz) : d;
+    const double *zLower = bz > 0 ? g.brick(bx, by, bz - 1) : d;
+    const double *zUpper = bz + 1 < nb[2] ? g.brick(bx, by, bz + 1) : d;
+    const int z0 = std::max(bz * b, 1) - bz * b;
+    const int z1 = std::min(bz * b + b, g.dims[2] - 1) - bz * b;
+    double s = 0.0;
+    for (int x = std::max(bx * b, 1); x < std::min(bx * b + b, g.dims[0] - 1); ++x)
+        for (int y = std::max(by * b, 1); y < std::min(by * b + b, g.dims[1] - 1); ++y) {
+            const int lx = x - bx * b, ly = y - by * b;
+            const int row = (lx * b + ly) * b;
+            const double *c = d + row;
+            const double *xm = lx > 0 ? c - b * b : xLower + row + (b - 1) * b * b;
+            const double *xp = lx < b - 1 ? c + b * b : xUpper + row - (b - 1) * b * b;
+            const double *ym = ly > 0 ? c - b : yLower + row + (b - 1) * b;
+            const double *yp = ly < b - 1 ? c + b : yUpper + row - (b - 1) * b;
+            double rowValues[BrickedGrid::brickSize];
+            for (int z = 0; z < b; ++z)
+                rowValues[z] = xm[z] + xp[z] + ym[z] + yp[z] - 6.0 * c[z];
+            for (int z = 1; z < b - 1; ++z)
+                rowValues[z] += c[z - 1] + c[z + 1];
+            rowValues[0] += zLower[row + b - 1] + c[1];
+            rowValues[b - 1] += c[b - 2] + zUpper[row];
+            for (int z = z0; z < z1; ++z)
+                s += std::abs(rowValues[z]);
+        }
+    return s;
+}
+
+double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+StencilBenchmark benchmarkStencilLayouts(const std::vector<double> &values, const int dims[3], int repetitions) {
+    StencilBenchmark result{0.0, 0.0, 0.0, 0.0};
+    const double interior = std::max(0.0, dims[0] - 2.0) * std::max(0.0, dims[1] - 2.0) * std::max(0.0, dims[2] - 2.0);
+    LinearGrid linear{values.data(), {dims[0], dims[1], dims[2]}};
+
+    auto start = std::chrono::steady_clock::now();
+    BrickedGrid bricked(values, dims);
+    result.conversionSeconds = seconds(start);
+
+    const int *nb = bricked.brickCounts();
+    const size_t brickTotal = static_cast<size_t>(nb[0]) * nb[1] * nb[2];
+    double linearSum = 0.0, brickedSum = 0.0;
+    double linearTime = 1e300, brickedTime = 1e300;
+    for (int r = 0; r < repetitions; ++r) {
+        // Both variants distribute the same amount of work per task: one x-slab of bricks.
+        std::vector<double> partial(static_cast<size_t>(nb[0]), 0.0);
+        start = std::chrono::steady_clock::now();
+        parallelFor(partial.size(), [&](size_t bx) {
+            partial[bx] = linearStencil(linear, static_cast<int>(bx) * BrickedGrid::brickSize,
+                                        static_cast<int>(bx + 1) * BrickedGrid::brickSize);
+        });
+        linearTime = std::min(linearTime, seconds(start));
+        linearSum = 0.0;
+        for (double p : partial)
+            linearSum += p;
+
+        std::vector<double> brickPartial(brickTotal, 0.0);
+        start = std::chrono::steady_clock::now();
+        parallelFor(brickTotal, [&](size_t k) {
+            int bz = static_cast<int>(k % nb[2]);
+            int by = static_cast<int>((k / nb[2]) % nb[1]);
+            int bx = static_cast<int>(k / (static_cast<size_t>(nb[1]) * nb[2]));
+            brickPartial[k] = brickStencil(bricked, bx, by, bz);
+        });
+        brickedTime = std::min(brickedTime, seconds(start));
+        brickedSum = 0.0;
+        for (double p : brickPartial)
+            brickedSum += p;
+    }
+    result.linearMVoxelsPerSecond = linearTime > 0 ? interior / linearTime / 1e6 : 0.0;
+    result.brickedMVoxelsPerSecond = brickedTime > 0 ? interior / brickedTime / 1e6 : 0.0;
+    result.checksumDifference = std::abs(linearSum - brickedSum);
+    return result;
+}
@@ -0,0 +1,194 @@
+/*
+ * CubeIsoFinder
+ * File: local_process_group.cpp
+ *
+ * Description:
+ *   Implements the local process group: forked processes exchanging data through a
+ *   shared memory region.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "distributed.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <pthread.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Control block at the start of the shared region, followed by one slot per process.
+struct SharedControl {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int arrived;
+    unsigned long generation;
+    int failed;
+};
+
+const size_t slotCapacity = 1 << 16; // Doubles per process and exchange step.
+
+class LocalProcessGroup : public ProcessGroup {
+public:
+    LocalProcessGroup(void *region, int rank, int size, const std::vector<pid_t> *children)
+        : control_(static_cast<SharedControl *>(region)),
+          slots_(reinterpret_cast<double *>(static_cast<char *>(region) + controlBytes())), rank_(rank), size_(size),
+          children_(children) {}
+
+    static size_t controlBytes() { return (sizeof(SharedControl) + 63) / 64 * 64; }
+    static size_t regionBytes(int size) { return controlBytes() + size * slotCapacity * sizeof(double); }
+
+    int rank() const override { return rank_; }
+    int size() const override { return size_; }
+
+    // Large contributions are exchanged in steps of slotCapacity values.
+    std::vector<double> allGather(const std::vector<double> &local) override {
+        const size_t n = local.size();
+        std::vector<double> all(n * size_);
+        for (size_t offset = 0; offset < n; offset += slotCapacity) {
+            const size_t m = std::min(slotCapacity, n - offset);
+            std::copy(local.begin() + offset, local.begin() + offset + m, slots_ + rank_ * slotCapacity);
+            barrier();
+            for (int r = 0; r < size_; ++r)
+                std::copy(slots_ + r * slotCapacity, slots_ + r * slotCapacity + m, all.begin() + r * n + offset);
+            barrier(); // Slots are reused only after every process has read them.
+        }
+        return all;
+    }
+
+    void abort() override {
+        pthread_mutex_lock(&control_->mutex);
+        control_->failed = 1;
+        pthread_cond_broadcast(&control_->cond);
+        pthread_mutex_unlock(&control_->mutex);
+    }
+
+private:
+    void barrier() {
+        pthread_mutex_lock(&control_->mutex);
+        const unsigned long generation = control_->generation;
+        if (!control_->failed && ++control_->arrived == size_) {
+            control_->arrived = 0;
+            ++control_->generation;
+            pthread_cond_broadcast(&control_->cond);
+        }
+        while (control_->generation == generation && !control_->failed) {
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if (pthread_cond_timedwait(&control_->cond, &control_->mutex, &deadline) == ETIMEDOUT && children_)
+                checkChildren();
+        }
+        const bool failed = control_->generation == generation && control_->failed;
+        pthread_mutex_unlock(&control_->mutex);
+        if (failed)
+            throw std::runtime_error("Another process of the group failed.");
+    }
+
+    // Rank 0 notices a child that died without calling abort() (e.g. killed by a signal).
+    void checkChildren() {
+        for (pid_t pid : *children_) {
+            int status = 0;
+            if (waitpid(pid, &status, WNOHANG | WNOWAIT) == pid) {
+                control_->failed = 1;
+                pthread_cond_broadcast(&control_->cond);
+            }
+        }
+    }
+
+    SharedControl *control_;
+    double *slots_;
+    int rank_;
+    int size_;
+    const std::vector<pid_t> *children_; // Only set in rank 0.
+};
+
+int runAsRank(LocalProcessGroup &group, const std::function<int(ProcessGroup &)> &body) {
+    int status = 1;
+    try {
+        status = body(group);
+    }
+    catch (const std::exception &ex) {
+        std::cerr << "Exception encountered: " << ex.what() << "\n";
+    }
+    if (status != 0)
+        group.abort();
+    return status;
+}
+
+} // namespace
+
+int runLocalProcessGroup(int processes, const std::function<int(ProcessGroup &)> &body) {
+    if (processes < 1)
+        throw std::runtime_error("The number of processes must be positive.");
+    const size_t bytes = LocalProcessGroup::regionBytes(processes);
+    void *region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        throw std::runtime_error(std::string("Unable to map shared memory: ") + std::strerror(errno));
+    SharedControl *control = static_cast<SharedControl *>(region);
+    pthread_mutexattr_t mutexAttr;
+    pthread_mutexattr_init(&mutexAttr);
+    pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&control->mutex, &mutexAttr);
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&control->cond, &condAttr);
+    control->arrived = 0;
+    control->generation = 0;
+    control->failed = 0;
+
+    // Buffered output would be written once by every process.
+    std::cout.flush();
+    std::cerr.flush();
+    std::vector<pid_t> children;
+    for (int r = 1; r < processes; ++r) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            LocalProcessGroup group(region, r, processes, nullptr);
+            int status = runAsRank(group, body);
+            std::cout.flush();
+            std::cerr.flush();
+            _exit(status);
+        }
+        if (pid < 0) {
+            control->failed = 1;
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    int result = 0;
+    if (control->failed) {
+        std::cerr << "Exception encountered: Unable to start " << processes << " processes.\n";
+        result = 1;
+    }
+    else {
+        LocalProcessGroup group(region, 0, processes, &children);
+        result = runAsRank(group, body);
+    }
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        result = std::max(result, code);
+    }
+    pthread_cond_destroy(&control->cond);
+    pthread_mutex_destroy(&control->mutex);
+    munmap(region, bytes);
+    return result;
+}
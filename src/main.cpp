@@ -13,23 +13,742 @@
  *   See LICENSE file in the project root for full license information.
  */
 
+#include "comparison.hpp"
+#include "cube_binary.hpp"
 #include "cube_parser.hpp"
+#include "cube_text_layout.hpp"
+#include "density_fields.hpp"
+#include "distributed.hpp"
+#include "grid_layout.hpp"
+#include "mass_index.hpp"
+#include "parallel.hpp"
+#include "quadrature.hpp"
+#include "spatial_analysis.hpp"
+#include "streaming.hpp"
+#include "volumetric_formats.hpp"
+#include "quantized_grid.hpp"
+#include "region_mask.hpp"
+#include "result_cache.hpp"
+#include "sharding.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
 // Print usage information.
 void printUsage(const char *progName) {
     std::cerr << "Usage:\n"
-              << "  " << progName << " <cube_file> (-p <percentage> | -v <isovalue>) [-s pos|neg]\n\n"
+              << "  " << progName << " <cube_file> (-p <percentage> | -v <isovalue>) [-s pos|neg] [--allow-truncated]\n"
+              << "  " << progName << " <cube_file> -c\n"
+              << "  " << progName << " <cube_file> (--to-cubeb | --to-cube) <output_file>\n"
+              << "  " << progName << " <cube_file> --bench-stencil\n"
+              << "  " << progName << " <cube_file> --bench-parse [--baseline <file>] [--tolerance <percent>]\n"
+              << "  " << progName << " <cube_file> --build-index <index_file>\n"
+              << "  " << progName << " <cube_file> --compare <cube_file>... -p <percentage> [-s pos|neg]\n"
+              << "  " << progName << " <manifest_file> --shard <i>/<N> --partial <output_file> (-p <percentage> | -v <isovalue>)\n"
+              << "  " << progName << " merge <partial_file>...\n"
+              << "  " << progName << " <cube_file> (--mpi | --processes <n>) (-p <percentage> | -v <isovalue>) [-s pos|neg]\n"
+              << "  " << progName << " <cube_file> --radial all|<atom>|<x,y,z> [--radial-bin <width>] [-p <percentage>]\n"
+              << "  " << progName << " <cube_file> (--slice <axis>=<k> | --line <axis>=<i>,<j>) [--cache | --cache-dir <dir>]\n\n"
+              << "The cube file may be a text cube, a binary .cubeb file, a VASP CHGCAR or an XSF file.\n\n"
               << "Options:\n"
               << "  -p <percentage>   Compute the isovalue corresponding to the given percentage of charge.\n"
               << "  -v <isovalue>     Compute the percentage of total charge enclosed by the given isovalue.\n"
-              << "  -s pos|neg        (For density files) Choose positive (default) or negative values for integration.\n";
+              << "  -s pos|neg        (For density files) Choose positive (default) or negative values for integration.\n"
+              << "  -c                Check the file for truncation, malformed values and layout anomalies.\n"
+              << "  --allow-truncated Process the valid prefix of a truncated or corrupted data block.\n"
+              << "  --to-cubeb <file> Convert the cube file to the compressed binary .cubeb format.\n"
+              << "  --to-cube <file>  Convert the cube file to the text cube format.\n"
+              << "  --bench-stencil   Measure 7-point stencil throughput in the flat and bricked grid layouts.\n"
+              << "  --bench-parse     Measure text cube parse throughput (MB/s).\n"
+              << "  --baseline <file> With --bench-parse: compare with the stored throughput and exit with\n"
+              << "                    status 2 on a regression; the file is created if it does not exist.\n"
+              << "  --tolerance <pct> Allowed throughput drop for --baseline (default: 10).\n"
+              << "  -i                Interpolate the isovalue (or percentage) between the two bracketing\n"
+              << "                    grid levels instead of snapping to a grid value.\n"
+              << "  -q <rule>         Quadrature rule: rect (default, plain voxel sum), trapezoid or simpson.\n"
+              << "  --periodic        Treat the grid as periodic when building quadrature weights.\n"
+              << "  -j <threads>      Number of worker threads (default: all cores). Results do not\n"
+              << "                    depend on the number of threads.\n"
+              << "  --quantize <err>  Report the error that 16-bit quantized storage with the given\n"
+              << "                    relative error bound (e.g. 1e-3) would induce.\n"
+              << "  --rdg-max <s>     (For density files) Restrict the integration to points whose reduced\n"
+              << "                    density gradient is below s (NCI regions, e.g. 0.5).\n"
+              << "  --write-rdg <file> Write the reduced density gradient as a cube file.\n"
+              << "  --write-gradient <base> Write the Cartesian density gradient components as the cube\n"
+              << "                    files <base>.x.cube, <base>.y.cube and <base>.z.cube.\n"
+              << "  --write-laplacian <file> Write the Laplacian of the density as a cube file.\n"
+              << "  --mask <file>     Restrict the integration to the grid points set in a bitmask file\n"
+              << "                    (one bit per point in x-major order, least significant bit first).\n"
+              << "  --mask-cube <f>   Restrict the integration to the points where the cube f (on the same\n"
+              << "                    grid) reaches --mask-threshold (|value| for orbitals).\n"
+              << "  --mask-threshold <t> Threshold for --mask-cube.\n"
+              << "  --mask-atoms <a>  Restrict the integration to spheres of --mask-radius around all atoms\n"
+              << "                    (all) or the given 1-based atoms (e.g. 1,3).\n"
+              << "  --mask-radius <r> Sphere radius for --mask-atoms in native units.\n"
+              << "  --write-mask <f>  Write the combined mask as a bitmask file.\n"
+              << "  --radial <centre> Radial profile around every atom (all), one atom (1-based index) or a\n"
+              << "                    point x,y,z in native units. With -p, also report the radius enclosing\n"
+              << "                    the given percentage.\n"
+              << "  --spin            (For spin density files) Report the alpha (positive) and beta (negative)\n"
+              << "                    excess regions at the same percentage or |isovalue|, and the net and\n"
+              << "                    absolute integrated spin.\n"
+              << "  --stream          With -v on a text cube: reduce the values while parsing, without\n"
+              << "                    storing the grid (prints the totals and the percentage only).\n"
+              << "  --cache           Reuse the stored output of an identical earlier -p/-v query on the\n"
+              << "                    same file contents (see --cache-dir).\n"
+              << "  --cache-dir <dir> Like --cache, with the cache in the given directory.\n"
+              << "  --build-index <f> Store the sorted cumulative-mass curve of the cube in an index file.\n"
+              << "  --index <file>    Answer -p/-v from the index file without parsing or sorting the cube.\n"
+              << "  --refine          With --index: make an estimated answer exact by scanning the cube once.\n"
+              << "  --compare <files> Compare with further cubes on the same grid: isovalues at the common\n"
+              << "                    percentage and the percentage each file encloses at each isovalue.\n"
+              << "  --shard <i>/<N>   Treat the first argument as a manifest (one cube file per line) and\n"
+              << "                    process the entries with index % N == i.\n"
+              << "  --partial <file>  With --shard: write the shard's results to this file for 'merge'.\n"
+              << "  --mpi             Split the grid into slabs across the MPI ranks (requires a build\n"
+              << "                    with -DCUBEISOFINDER_MPI=ON).\n"
+              << "  --processes <n>   Split the grid into n slabs analysed by n local processes that\n"
+              << "                    exchange histograms through shared memory.\n"
+              << "  --radial-bin <w>  Shell width of the radial profile in native units (default: 0.1).\n"
+              << "  --slice <a>=<k>   Print the plane with 0-based index k along axis a (x, y or z), parsing\n"
+              << "                    only the rows of a text cube that hold it.\n"
+              << "  --line <a>=<i>,<j> Print the values along axis a through the point with indices i and j\n"
+              << "                    on the other two axes (in x, y, z order). With --cache, the row index\n"
+              << "                    of a text cube without a fixed-width layout is stored for later runs.\n";
+}
+
+// Print the result of validateCubeFile. Returns true if the data block is intact.
+bool printValidationReport(const std::string &filename, const CubeValidationReport &report) {
+    std::cout << "Checking file: " << filename << "\n";
+    std::cout << "Grid dimensions: " << report.header.dims[0] << " x "
+              << report.header.dims[1] << " x " << report.header.dims[2] << "\n";
+    std::cout << "Data block starts at byte offset: " << report.dataOffset << "\n";
+    if (report.expectedDataBytes > 0)
+        std::cout << "Data bytes (expected from fixed-width layout / actual): "
+                  << report.expectedDataBytes << " / " << report.actualDataBytes << "\n";
+    else
+        std::cout << "Data bytes: " << report.actualDataBytes << " (layout is not fixed-width)\n";
+    std::cout << "Grid points (expected / valid): " << report.expectedPoints << " / " << report.pointsFound << "\n";
+    if (report.malformed)
+        std::cout << "Malformed value at byte offset " << report.errorOffset << "\n";
+    else if (report.truncated)
+        std::cout << "File is truncated; valid data ends at byte offset " << report.errorOffset << "\n";
+    if (report.anomalyCount > 0) {
+        std::cout << "Layout anomalies (lines with an unexpected number of values): " << report.anomalyCount << "\n";
+        for (const auto &a : report.lineAnomalies)
+            std::cout << "  line " << a.line << " (byte offset " << a.offset << "): expected "
+                      << a.expected << ", found " << a.found << "\n";
+        if (report.anomalyCount > report.lineAnomalies.size())
+            std::cout << "  ...\n";
+    }
+    bool intact = !report.malformed && !report.truncated && report.pointsFound == report.expectedPoints;
+    std::cout << "Status: " << (intact ? "OK" : "DAMAGED") << "\n";
+    return intact;
+}
+
+// Print the sign-resolved orbital results.
+void printOrbitalPhases(const OrbitalPhaseReport &phases, double inputValue, bool fromPercentage,
+                        const std::string &nativeUnit) {
+    auto print = [&](const char *name, const OrbitalPhase &phase) {
+        std::cout << "  " << name << " phase: " << phase.phasePercent << "% of the orbital density";
+        if (fromPercentage)
+            std::cout << ", isovalue for " << inputValue << "% of the phase: " << phase.isovalue
+                      << " (native, electrons/" << nativeUnit << "^(3/2)), enclosed by the combined isovalue: "
+                      << phase.combinedEnclosedPercent << "%\n";
+        else
+            std::cout << ", enclosed by the isovalue: " << phase.enclosedPercent << "%\n";
+    };
+    std::cout << "Sign-resolved orbital analysis:\n";
+    print("Positive", phases.positive);
+    print("Negative", phases.negative);
+}
+
+// Print the alpha- and beta-excess regions of a spin density and its integrals.
+void printSpinDensity(const SpinDensityReport &spin, double inputValue, bool fromPercentage, double voxelVolume,
+                      bool nativeIsAngstrom, const std::string &nativeUnit, const std::string &convUnit) {
+    auto print = [&](const char *name, const SpinExcess &excess) {
+        std::cout << "  " << name << " excess: integral " << excess.integral * voxelVolume;
+        if (fromPercentage)
+            std::cout << ", isovalue for " << inputValue << "%: " << excess.isovalue << " (native, electrons/"
+                      << nativeUnit << "^3), " << convertDensity(excess.isovalue, nativeIsAngstrom)
+                      << " (converted, electrons/" << convUnit << "^3), enclosed: " << excess.enclosedPercent << "%\n";
+        else
+            std::cout << ", enclosed by isovalue " << excess.isovalue << ": " << excess.enclosedPercent << "%\n";
+    };
+    std::cout << "Spin density analysis:\n";
+    print("Alpha", spin.alpha);
+    print("Beta", spin.beta);
+    std::cout << "Net integrated spin: " << spin.net * voxelVolume << "\n"
+              << "Absolute integrated spin: " << spin.absolute * voxelVolume << "\n";
+}
+
+// Print -p/-v results with quadrature weights applied to every grid point.
+void printWeightedIntegration(const CubeData &cube, const QuadratureWeights &weights, bool usePercentage,
+                              double inputValue, bool positive, bool interpolate, double voxelVolume,
+                              bool nativeIsAngstrom) {
+    const bool orbital = cube.header.isOrbital;
+    std::string nativeUnit = nativeIsAngstrom ? "Å" : "bohr";
+    std::string convUnit = nativeIsAngstrom ? "bohr" : "Å";
+    std::string isoUnit = orbital ? "^(3/2)" : "^3";
+    auto convert = [&](double v) {
+        return orbital ? convertOrbital(v, nativeIsAngstrom) : convertDensity(v, nativeIsAngstrom);
+    };
+    double totalIntegrated = integrateWeighted(cube.values, weights, orbital) * voxelVolume;
+    std::cout << "Total integrated " << (orbital ? "orbital" : "electron") << " density (weighted quadrature): "
+              << totalIntegrated << "\n";
+    if (usePercentage) {
+        double isovalue_native = computeIsovalueFromPercentage_Weighted(cube.values, weights, inputValue, orbital,
+                                                                        positive, interpolate);
+        std::cout << "Isovalue (" << (orbital ? "orbital" : "density") << ") corresponding to " << inputValue << "%:\n"
+                  << "  " << isovalue_native << " (native, electrons/" << nativeUnit << isoUnit << ")\n"
+                  << "  " << convert(isovalue_native) << " (converted, electrons/" << convUnit << isoUnit << ")\n";
+        double enclosedPercentage = computePercentageFromIsovalue_Weighted(cube.values, weights, isovalue_native,
+                                                                           orbital, positive, interpolate);
+        std::cout << "Computed percentage of total weighted quantity above threshold: " << enclosedPercentage << "%\n";
+    }
+    else {
+        double percentage = computePercentageFromIsovalue_Weighted(cube.values, weights, inputValue, orbital,
+                                                                   positive, interpolate);
+        std::cout << "The percentage of total charge enclosed by isovalue " << inputValue
+                  << " (electrons/" << nativeUnit << isoUnit << ") is: " << percentage << "%\n";
+        std::cout << "Converted isovalue: " << convert(inputValue) << " electrons/" << convUnit << isoUnit << "\n";
+    }
+}
+
+// Quantize a copy of the grid (2 bytes per value next to the exact grid) and report how
+// much the result moves; the analysis itself always runs on the exact grid.
+// For -p the induced error is the difference in enclosed percentage, evaluated on the
+// exact grid, between the quantized and the exact isovalue; for -v it is the
+// difference between the quantized and the exact percentage.
+void printQuantizationReport(const CubeData &cube, bool usePercentage, double inputValue, bool positive,
+                             double relativeError) {
+    const bool orbital = cube.header.isOrbital;
+    auto isoExact = [orbital](const std::vector<double> &values, double percent, bool positive) {
+        return orbital ? computeIsovalueFromPercentage_Orbital(values, percent, positive)
+                       : computeIsovalueFromPercentage_Density(values, percent, positive);
+    };
+    auto pctExact = [orbital](const std::vector<double> &values, double isovalue, bool positive) {
+        return orbital ? computePercentageFromIsovalue_Orbital(values, isovalue, positive)
+                       : computePercentageFromIsovalue_Density(values, isovalue, positive);
+    };
+    const std::vector<double> &exactValues = cube.values;
+    size_t exactBytes = cube.values.size() * sizeof(double);
+    const QuantizedGrid quantized = quantizeGrid(cube.values, relativeError);
+    size_t quantizedBytes = quantized.codes.size() * sizeof(uint16_t);
+
+    std::cout << "Quantized storage (relative error bound " << relativeError << "): "
+              << quantizedBytes << " bytes instead of " << exactBytes << " bytes\n";
+    if (usePercentage) {
+        double exactIso = isoExact(exactValues, inputValue, positive);
+        double quantIso = orbital ? computeIsovalueFromPercentage_Orbital(quantized, inputValue, positive)
+                                  : computeIsovalueFromPercentage_Density(quantized, inputValue, positive);
+        double exactPct = pctExact(exactValues, exactIso, positive);
+        double quantPct = pctExact(exactValues, quantIso, positive);
+        std::cout << "  Isovalue (exact / quantized): " << exactIso << " / " << quantIso << "\n"
+                  << "  Enclosed percentage on the exact grid (exact / quantized isovalue): "
+                  << exactPct << "% / " << quantPct << "%\n"
+                  << "  Induced error in enclosed percentage: " << std::abs(quantPct - exactPct) << "\n";
+    }
+    else {
+        double exactPct = pctExact(exactValues, inputValue, positive);
+        double quantPct = orbital ? computePercentageFromIsovalue_Orbital(quantized, inputValue, positive)
+                                  : computePercentageFromIsovalue_Density(quantized, inputValue, positive);
+        std::cout << "  Enclosed percentage (exact / quantized): " << exactPct << "% / " << quantPct << "%\n"
+                  << "  Induced error in enclosed percentage: " << std::abs(quantPct - exactPct) << "\n";
+    }
+}
+
+// Write the reduced density gradient as a cube; points with rho <= 0 are written as 100,
+// the conventional "no density" value of NCI tools.
+void writeReducedGradientCube(const CubeData &cube, const DensityFields &fields, const std::string &filename) {
+    CubeData rdg;
+    rdg.header = cube.header;
+    rdg.header.comment1 = "Reduced density gradient s(rho)";
+    rdg.values = fields.reducedGradient;
+    for (double &s : rdg.values)
+        if (!std::isfinite(s))
+            s = 100.0;
+    writeCubeFile(rdg, filename);
+    std::cout << "Reduced density gradient written to " << filename << "\n";
+}
+
+// Write the gradient components (in native units per length) and the Laplacian as cubes.
+void writeGradientCubes(const CubeData &cube, const DensityFields &fields, const std::string &base) {
+    static const char axes[] = "xyz";
+    for (int k = 0; k < 3; ++k) {
+        CubeData component;
+        component.header = cube.header;
+        component.header.comment1 = std::string("Density gradient, ") + axes[k] + " component";
+        component.values = fields.gradient[k];
+        const std::string filename = base + "." + axes[k] + ".cube";
+        writeCubeFile(component, filename);
+        std::cout << "Density gradient (" << axes[k] << ") written to " << filename << "\n";
+    }
+}
+
+void writeLaplacianCube(const CubeData &cube, const DensityFields &fields, const std::string &filename) {
+    CubeData laplacian;
+    laplacian.header = cube.header;
+    laplacian.header.comment1 = "Laplacian of the density";
+    laplacian.values = fields.laplacian;
+    writeCubeFile(laplacian, filename);
+    std::cout << "Laplacian of the density written to " << filename << "\n";
+}
+
+// Replace the density by its restriction to s < rdgMax and report the region.
+void restrictToReducedGradient(CubeData &cube, const DensityFields &fields, double rdgMax, double voxelVolume) {
+    double fullTotal = blockedSum(cube.values.size(), [&](size_t i) { return cube.values[i]; }) * voxelVolume;
+    cube.values = maskByReducedGradient(cube.values, fields, rdgMax);
+    size_t selected = 0;
+    for (double s : fields.reducedGradient)
+        selected += s < rdgMax;
+    double regionTotal = blockedSum(cube.values.size(), [&](size_t i) { return cube.values[i]; }) * voxelVolume;
+    std::cout << "Restricting to reduced density gradient s < " << rdgMax << ": " << selected << " grid points, "
+              << regionTotal << " electrons (" << (fullTotal != 0.0 ? 100.0 * regionTotal / fullTotal : 0.0)
+              << "% of the full grid)\n"
+              << "Percentages below refer to the density in this region.\n";
+}
+
+// Region masks requested on the command line; several masks are intersected.
+struct MaskOptions {
+    std::string file;
+    std::string cube;
+    double threshold = std::numeric_limits<double>::quiet_NaN();
+    std::string atoms;
+    double radius = 0.0;
+    std::string output;
+
+    bool any() const { return !file.empty() || !cube.empty() || !atoms.empty(); }
+
+    // Canonical description for the result cache, including the contents of the mask files.
+    std::string describe() const {
+        std::ostringstream out;
+        out << std::setprecision(17);
+        if (!file.empty())
+            out << "file:" << hashFile(file) << ";";
+        if (!cube.empty())
+            out << "cube:" << hashFile(cube) << ">=" << threshold << ";";
+        if (!atoms.empty())
+            out << "atoms:" << atoms << "@" << radius << ";";
+        return out.str();
+    }
+};
+
+// Build the requested mask, optionally write it, and zero the grid outside it.
+void restrictToRegionMask(CubeData &cube, const MaskOptions &options, double voxelVolume) {
+    const bool orbital = cube.header.isOrbital;
+    auto quantity = [&](size_t i) { return orbital ? cube.values[i] * cube.values[i] : cube.values[i]; };
+    RegionMask mask;
+    std::vector<std::string> parts;
+    auto combine = [&](RegionMask part, const std::string &description) {
+        if (parts.empty())
+            mask = std::move(part);
+        else
+            intersectRegionMasks(mask, part);
+        parts.push_back(description);
+    };
+    if (!options.file.empty())
+        combine(readRegionMaskFile(options.file, cube.header), "bitmask " + options.file);
+    if (!options.cube.empty()) {
+        if (std::isnan(options.threshold))
+            throw std::runtime_error("--mask-cube requires --mask-threshold.");
+        std::ostringstream description;
+        description << options.cube << " >= " << options.threshold;
+        combine(regionMaskFromCube(loadCube(options.cube), cube.header, options.threshold), description.str());
+    }
+    if (!options.atoms.empty()) {
+        std::ostringstream description;
+        description << "atoms " << options.atoms << " within " << options.radius;
+        combine(regionMaskFromAtoms(cube.header, options.atoms, options.radius), description.str());
+    }
+    if (!options.output.empty()) {
+        writeRegionMaskFile(mask, options.output);
+        std::cout << "Region mask written to " << options.output << "\n";
+    }
+
+    double fullTotal = blockedSum(cube.values.size(), quantity) * voxelVolume;
+    applyRegionMask(cube.values, mask);
+    double regionTotal = blockedSum(cube.values.size(), quantity) * voxelVolume;
+    std::cout << "Restricting to the region mask (";
+    for (size_t p = 0; p < parts.size(); ++p)
+        std::cout << (p ? " and " : "") << parts[p];
+    std::cout << "): " << mask.count << " grid points, " << regionTotal
+              << (orbital ? " (integrated orbital density, " : " electrons (")
+              << (fullTotal != 0.0 ? 100.0 * regionTotal / fullTotal : 0.0) << "% of the full grid)\n"
+              << "Percentages below refer to the " << (orbital ? "orbital density" : "density")
+              << " in this region.\n";
+}
+
+// Print the spatial moments of the region enclosed by the isovalue.
+void printRegionMoments(const RegionMoments &region, const std::string &nativeUnit) {
+    std::cout << "Enclosed region: " << region.points << " grid points\n";
+    if (region.mass == 0.0)
+        return;
+    const double *c = region.centroid;
+    const double *d = region.firstMoment;
+    std::cout << "  Centroid (" << nativeUnit << "): " << c[0] << " " << c[1] << " " << c[2] << "\n"
+              << "  First moment (integral of rho * r, " << nativeUnit << "): " << d[0] << " " << d[1] << " " << d[2]
+              << "\n"
+              << "  Second moments about the centroid (" << nativeUnit << "^2):\n";
+    for (const auto &row : region.secondMoments)
+        std::cout << "    " << row[0] << " " << row[1] << " " << row[2] << "\n";
+    std::cout << "  Radius of gyration: " << region.radiusOfGyration << " " << nativeUnit << "\n";
+}
+
+// Print the result of the streaming -v mode in the same form as the in-memory path.
+void printStreamingResult(const std::string &filename, const StreamingResult &result, double isovalue) {
+    const CubeHeader &header = result.header;
+    bool nativeIsAngstrom = detectAngstrom(header);
+    std::string nativeUnit = nativeIsAngstrom ? "Å" : "bohr";
+    std::string convUnit = nativeIsAngstrom ? "bohr" : "Å";
+    double voxelVolume = computeVoxelVolume(header);
+    size_t expectedPoints = static_cast<size_t>(header.dims[0]) * header.dims[1] * header.dims[2];
+
+    std::cout << "Processing file (streaming): " << filename << "\n"
+              << "Calculation type detected: " << header.calcType << "\n"
+              << "Data type detected: " << (header.isOrbital ? "Orbital" : "Density") << "\n"
+              << "Grid dimensions: " << header.dims[0] << " x " << header.dims[1] << " x " << header.dims[2] << "\n"
+              << "Voxel volume: " << voxelVolume << " " << nativeUnit << "^3\n";
+    if (result.points < expectedPoints)
+        std::cout << "Warning: truncated data; processing the first " << result.points << " of " << expectedPoints
+                  << " grid points.\n";
+    if (header.isOrbital) {
+        std::cout << "Total integrated orbital density: " << result.sum * voxelVolume << "\n"
+                  << "For orbital data, the percentage of total charge enclosed by isovalue " << isovalue
+                  << " (electrons/" << nativeUnit << "^(3/2)) is: " << result.percentage << "%\n"
+                  << "Converted isovalue: " << convertOrbital(isovalue, nativeIsAngstrom) << " electrons/"
+                  << convUnit << "^(3/2)\n";
+    }
+    else {
+        std::cout << "Total integrated electron density: " << result.sum * voxelVolume << "\n"
+                  << "For density data, the percentage of total charge enclosed by isovalue " << isovalue
+                  << " (electrons/" << nativeUnit << "^3) is: " << result.percentage << "%\n"
+                  << "Converted isovalue: " << convertDensity(isovalue, nativeIsAngstrom) << " electrons/"
+                  << convUnit << "^3\n";
+    }
+}
+
+// Answer a -p or -v query from a cumulative-mass index; with refine, an estimated answer
+// is made exact by loading the cube.
+void printIndexQuery(const std::string &filename, const MassIndex &index, bool usePercentage, double inputValue,
+                     bool positive, bool refine, bool allowTruncated) {
+    const CubeHeader &header = index.header;
+    bool nativeIsAngstrom = detectAngstrom(header);
+    std::string nativeUnit = nativeIsAngstrom ? "Å" : "bohr";
+    std::string convUnit = nativeIsAngstrom ? "bohr" : "Å";
+    MassCurve curve = header.isOrbital ? MassCurve::Orbital : (positive ? MassCurve::Positive : MassCurve::Negative);
+    std::string unit = header.isOrbital ? "^(3/2)" : "^3";
+    auto convert = [&](double v) {
+        return header.isOrbital ? convertOrbital(v, nativeIsAngstrom) : convertDensity(v, nativeIsAngstrom);
+    };
+
+    auto query = [&](const std::vector<double> *values) {
+        return usePercentage ? isovalueFromIndex(index, curve, inputValue, values)
+                             : percentageFromIndex(index, curve, inputValue, values);
+    };
+    IndexAnswer answer = query(nullptr);
+    bool refined = false;
+    if (!answer.exact && refine) {
+        CubeData cube = loadCube(filename, allowTruncated);
+        answer = query(&cube.values);
+        refined = true;
+    }
+
+    std::cout << "Processing file (from index): " << filename << "\n"
+              << "Data type detected: " << (header.isOrbital ? "Orbital" : "Density") << "\n"
+              << "Grid dimensions: " << header.dims[0] << " x " << header.dims[1] << " x " << header.dims[2] << "\n";
+    if (usePercentage) {
+        std::cout << "Isovalue (" << (header.isOrbital ? "orbital" : "density") << ") corresponding to "
+                  << inputValue << "%:\n"
+                  << "  " << answer.value << " (native, electrons/" << nativeUnit << unit << ")\n"
+                  << "  " << convert(answer.value) << " (converted, electrons/" << convUnit << unit << ")\n";
+    }
+    else {
+        std::cout << "Percentage of total " << (header.isOrbital ? "orbital density" : "charge")
+                  << " enclosed by isovalue " << inputValue << " (electrons/" << nativeUnit << unit
+                  << ") is: " << answer.value << "%\n";
+    }
+    if (refined)
+        std::cout << "Result refined from the cube file.\n";
+    else if (answer.exact)
+        std::cout << "Result is exact.\n";
+    else
+        std::cout << "Result is an estimate; the exact value lies in [" << answer.lower << ", " << answer.upper
+                  << "]" << (usePercentage ? "" : "%") << " (use --refine for the exact value).\n";
+}
+
+// Print the isovalues of a comparison and its cross matrix.
+void printComparison(const std::vector<std::string> &filenames, const CubeComparison &cmp, double percent) {
+    std::string nativeUnit = detectAngstrom(cmp.header) ? "Å" : "bohr";
+    bool orbital = cmp.header.isOrbital;
+    std::cout << "Comparing " << filenames.size() << " files on a common " << cmp.header.dims[0] << " x "
+              << cmp.header.dims[1] << " x " << cmp.header.dims[2] << " grid ("
+              << (orbital ? "orbital" : "density") << " data)\n"
+              << "Isovalues corresponding to " << percent << "% (native, electrons/" << nativeUnit
+              << (orbital ? "^(3/2)" : "^3") << "):\n";
+    for (size_t i = 0; i < filenames.size(); ++i)
+        std::cout << "  [" << i + 1 << "] " << filenames[i] << ": " << cmp.isovalues[i]
+                  << " (total " << cmp.totals[i] << ")\n";
+    std::cout << "Percentage of file [column] enclosed by the isovalue of file [row]:\n       ";
+    for (size_t j = 0; j < filenames.size(); ++j)
+        std::cout << std::setw(10) << ("[" + std::to_string(j + 1) + "]");
+    std::cout << "\n";
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        std::cout << std::setw(7) << ("[" + std::to_string(i + 1) + "]");
+        for (size_t j = 0; j < filenames.size(); ++j)
+            std::cout << std::setw(10) << cmp.cross[i][j];
+        std::cout << "\n";
+    }
+}
+
+// Compare parse throughput with the baseline file, or create the baseline if it does not
+// exist yet. Returns 2 if the throughput dropped by more than tolerance percent.
+int checkParseBaseline(const std::string &filename, const ParseBenchmark &bench, double tolerance) {
+    std::ifstream in(filename);
+    if (!in) {
+        std::ofstream out(filename);
+        out << "parse_mb_per_s " << std::setprecision(17) << bench.megabytesPerSecond << "\n";
+        if (!out)
+            throw std::runtime_error("Unable to write baseline file: " + filename);
+        std::cout << "Baseline written to " << filename << "\n";
+        return 0;
+    }
+    std::string key;
+    double baseline = 0.0;
+    if (!(in >> key >> baseline) || key != "parse_mb_per_s" || baseline <= 0.0)
+        throw std::runtime_error("Malformed baseline file: " + filename);
+    const double change = (bench.megabytesPerSecond / baseline - 1.0) * 100.0;
+    std::cout << "  Baseline:    " << baseline << " MB/s (" << std::showpos << change << std::noshowpos << "%)\n";
+    if (change < -tolerance) {
+        std::cout << "Parse throughput regressed by more than " << tolerance << "%.\n";
+        return 2;
+    }
+    return 0;
+}
+
+// Print the merged entries of a sharded batch in manifest order, one line per cube.
+void printMergedShards(const std::vector<ShardEntry> &entries, const std::string &query) {
+    size_t failed = 0;
+    std::cout << "Merged results for " << entries.size() << " cubes (" << query << "):\n"
+              << "index\tstatus\ttype\ttotal\tisovalue\tpercentage\tfile\n"
+              << std::setprecision(17);
+    for (const ShardEntry &e : entries) {
+        std::cout << e.index << "\t" << (e.ok ? "ok" : "error") << "\t";
+        if (e.ok)
+            std::cout << (e.isOrbital ? "orbital" : "density") << "\t" << e.total << "\t" << e.isovalue << "\t"
+                      << e.percentage << "\t" << e.file << "\n";
+        else
+            std::cout << "-\t-\t-\t-\t" << e.file << " (" << e.message << ")\n";
+        failed += e.ok ? 0 : 1;
+    }
+    std::cout << std::setprecision(6);
+    if (failed)
+        std::cout << failed << " of " << entries.size() << " cubes failed.\n";
+}
+
+// Print the result of a distributed -p/-v run (on rank 0 only).
+void printDistributedResult(const std::string &filename, const GridSlab &slab, const DistributedResult &result,
+                            int processes, bool usePercentage, double inputValue) {
+    const CubeHeader &h = slab.header;
+    const bool orbital = h.isOrbital;
+    const bool nativeIsAngstrom = detectAngstrom(h);
+    std::string nativeUnit = nativeIsAngstrom ? "Å" : "bohr";
+    std::string convUnit = nativeIsAngstrom ? "bohr" : "Å";
+    std::string isoUnit = orbital ? "^(3/2)" : "^3";
+    std::cout << "Processing file: " << filename << " in " << processes << " slabs\n"
+              << "Data type detected: " << (orbital ? "Orbital" : "Density") << "\n"
+              << "Grid points: " << result.points << "\n"
+              << "Integrated " << (orbital ? "orbital density" : "electron density of the selected sign") << ": "
+              << result.total * computeVoxelVolume(h) << "\n";
+    if (usePercentage) {
+        double converted = orbital ? convertOrbital(result.isovalue, nativeIsAngstrom)
+                                   : convertDensity(result.isovalue, nativeIsAngstrom);
+        std::cout << "Isovalue corresponding to " << inputValue << "%:\n"
+                  << "  " << result.isovalue << " (native, electrons/" << nativeUnit << isoUnit << ")\n"
+                  << "  " << converted << " (converted, electrons/" << convUnit << isoUnit << ")\n"
+                  << "Computed percentage enclosed by the isovalue: " << result.percentage << "%\n";
+    }
+    else {
+        std::cout << "Percentage enclosed by isovalue " << inputValue << " (electrons/" << nativeUnit << isoUnit
+                  << "): " << result.percentage << "%\n";
+    }
+}
+
+// Print radial profiles around the centres selected by spec: "all" (every atom), a
+// 1-based atom index, or a point "x,y,z" in native units.
+void printRadialProfiles(const CubeData &cube, const std::string &spec, double binWidth, bool usePercentage,
+                         double percent) {
+    std::vector<std::array<double, 3>> centers;
+    std::vector<std::string> labels;
+    const auto &atoms = cube.header.atoms;
+    if (spec == "all") {
+        for (size_t a = 0; a < atoms.size(); ++a) {
+            centers.push_back({atoms[a].position[0], atoms[a].position[1], atoms[a].position[2]});
+            labels.push_back("atom " + std::to_string(a + 1) + " (Z = " + std::to_string(atoms[a].atomicNumber) + ")");
+        }
+        if (centers.empty())
+            throw std::runtime_error("The file contains no atoms.");
+    }
+    else if (spec.find(',') != std::string::npos) {
+        std::array<double, 3> p{};
+        std::istringstream in(spec);
+        std::string field;
+        int c = 0;
+        while (std::getline(in, field, ',') && c < 3) {
+            try {
+                p[c++] = std::stod(field);
+            }
+            catch (const std::logic_error &) {
+                throw std::runtime_error("Radial centre coordinate must be a number, got '" + field + "'.");
+            }
+        }
+        if (c != 3)
+            throw std::runtime_error("Radial centre must be given as x,y,z.");
+        centers.push_back(p);
+        labels.push_back("point (" + spec + ")");
+    }
+    else {
+        size_t a = 0;
+        try {
+            a = std::stoul(spec);
+        }
+        catch (const std::logic_error &) {
+            throw std::runtime_error("--radial takes all, an atom index or x,y,z, got '" + spec + "'.");
+        }
+        if (a < 1 || a > atoms.size())
+            throw std::runtime_error("Atom index out of range: " + spec);
+        centers.push_back({atoms[a - 1].position[0], atoms[a - 1].position[1], atoms[a - 1].position[2]});
+        labels.push_back("atom " + spec + " (Z = " + std::to_string(atoms[a - 1].atomicNumber) + ")");
+    }
+
+    std::string nativeUnit = detectAngstrom(cube.header) ? "Å" : "bohr";
+    GridCoordinates coords = buildGridCoordinates(cube.header);
+    for (size_t c = 0; c < centers.size(); ++c) {
+        RadialProfile profile = computeRadialProfile(cube, coords, centers[c].data(), binWidth);
+        std::cout << "Radial profile around " << labels[c] << " at (" << centers[c][0] << ", " << centers[c][1]
+                  << ", " << centers[c][2] << "), shell width " << binWidth << " " << nativeUnit << ":\n"
+                  << "  r_outer  shell  cumulative  cumulative%\n";
+        for (size_t b = 0; b < profile.shell.size(); ++b)
+            std::cout << "  " << (b + 1) * binWidth << "  " << profile.shell[b] << "  " << profile.cumulative[b]
+                      << "  " << (profile.total != 0.0 ? 100.0 * profile.cumulative[b] / profile.total : 0.0) << "\n";
+        if (usePercentage)
+            std::cout << "  Radius enclosing " << percent << "%: " << radiusEnclosingPercentage(profile, percent)
+                      << " " << nativeUnit << "\n";
+    }
+}
+
+// Print a plane (--slice <axis>=<k>) or a line (--line <axis>=<i>,<j>) of the grid. Text
+// cubes are read only at the rows that hold the requested points.
+void printGridSection(const std::string &filename, const std::string &spec, bool isSlice,
+                      const std::string &cacheDirectory) {
+    static const char axes[] = "xyz";
+    const char *axisName = spec.size() > 2 && spec[1] == '=' ? std::strchr(axes, spec[0]) : nullptr;
+    if (!axisName)
+        throw std::runtime_error("Expected <axis>=<index> with axis x, y or z, got '" + spec + "'.");
+    const int axis = static_cast<int>(axisName - axes);
+    std::vector<int> indices;
+    std::istringstream in(spec.substr(2));
+    std::string field;
+    while (std::getline(in, field, ',')) {
+        try {
+            indices.push_back(std::stoi(field));
+        } catch (const std::logic_error &) {
+            throw std::runtime_error("Grid index must be a number, got '" + field + "'.");
+        }
+    }
+    if (indices.size() != (isSlice ? 1u : 2u))
+        throw std::runtime_error(isSlice ? "--slice takes one index, e.g. z=10."
+                                         : "--line takes two indices, e.g. z=3,4.");
+
+    // Text cubes parse only the needed rows and .cubeb files decompress only the needed
+    // slabs; CHGCAR and XSF files are loaded whole.
+    const VolumetricFormat format = detectVolumetricFormat(filename);
+    std::unique_ptr<CubeTextFile> text;
+    CubeData loaded;
+    if (format == VolumetricFormat::Cube)
+        text = std::make_unique<CubeTextFile>(filename, cacheDirectory);
+    else if (format == VolumetricFormat::CubeBinary)
+        loaded.header = readCubeBinaryInfo(filename).header;
+    else
+        loaded = loadCube(filename);
+    const CubeHeader &h = text ? text->header() : loaded.header;
+    // The box of a .cubeb section: one index on the fixed axes, the full range elsewhere.
+    auto readBinarySection = [&](const std::vector<int> &fixedAxes) {
+        int lo[3] = {0, 0, 0}, hi[3] = {h.dims[0], h.dims[1], h.dims[2]};
+        for (size_t i = 0; i < fixedAxes.size(); ++i) {
+            const int a = fixedAxes[i];
+            if (indices[i] < 0 || indices[i] >= h.dims[a])
+                throw std::runtime_error(std::string("Error: Index ") + std::to_string(indices[i]) + " on the " +
+                                         axes[a] + " axis is out of range (0 to " + std::to_string(h.dims[a] - 1) +
+                                         ").");
+            lo[a] = indices[i];
+            hi[a] = indices[i] + 1;
+        }
+        return readCubeBinaryBox(filename, lo, hi);
+    };
+    std::string unit = std::string("electrons/") + (detectAngstrom(h) ? "Å" : "bohr") +
+                       (h.isOrbital ? "^(3/2)" : "^3");
+    const int first = axis == 0 ? 1 : 0, second = axis == 2 ? 1 : 2;
+
+    if (isSlice) {
+        std::vector<double> plane = text ? extractSlice(*text, axis, indices[0])
+                                    : format == VolumetricFormat::CubeBinary ? readBinarySection({axis})
+                                                                             : extractSlice(loaded, axis, indices[0]);
+        const int columns = h.dims[second];
+        std::cout << "Slice " << axes[axis] << " = " << indices[0] << " of " << filename << ": " << h.dims[first]
+                  << " x " << columns << " points (rows along " << axes[first] << ", columns along "
+                  << axes[second] << "), values in " << unit << "\n";
+        for (size_t i = 0; i < plane.size(); ++i)
+            std::cout << plane[i] << ((i + 1) % columns == 0 ? "\n" : " ");
+        return;
+    }
+
+    std::vector<double> values = text ? extractLine(*text, axis, indices[0], indices[1])
+                                 : format == VolumetricFormat::CubeBinary ? readBinarySection({first, second})
+                                                                          : extractLine(loaded, axis, indices[0], indices[1]);
+    std::cout << "Line along " << axes[axis] << " through " << axes[first] << " = " << indices[0] << ", "
+              << axes[second] << " = " << indices[1] << " of " << filename << ": " << values.size()
+              << " points\n"
+              << "  index  x  y  z (" << (detectAngstrom(h) ? "Å" : "bohr") << ")  value (" << unit << ")\n";
+    int point[3];
+    point[first] = indices[0];
+    point[second] = indices[1];
+    for (size_t t = 0; t < values.size(); ++t) {
+        point[axis] = static_cast<int>(t);
+        double r[3];
+        for (int c = 0; c < 3; ++c)
+            r[c] = h.origin[c] + point[0] * h.axisVectors[0][c + 1] + point[1] * h.axisVectors[1][c + 1] +
+                   point[2] * h.axisVectors[2][c + 1];
+        std::cout << "  " << t << "  " << r[0] << "  " << r[1] << "  " << r[2] << "  " << values[t] << "\n";
+    }
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 4) {
+    // "merge <partial_file>..." combines the partial results of a sharded batch.
+    if (argc >= 3 && std::string(argv[1]) == "merge") {
+        try {
+            std::vector<ShardPartial> partials;
+            for (int i = 2; i < argc; ++i)
+                partials.push_back(readShardPartial(argv[i]));
+            printMergedShards(mergeShardPartials(partials), partials[0].query);
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (argc < 3) {
         printUsage(argv[0]);
         return 1;
     }
@@ -39,6 +758,38 @@ int main(int argc, char *argv[]) {
     bool useIsovalue = false;
     double inputValue = 0.0;
     bool positive = true; // Default for density data.
+    bool checkOnly = false;
+    bool allowTruncated = false;
+    std::string convertFilename;
+    bool convertToBinary = false;
+    double quantizeError = 0.0;
+    bool benchStencil = false;
+    bool benchParse = false;
+    std::string baselineFilename;
+    double tolerance = 10.0;
+    bool interpolate = false;
+    QuadratureRule quadratureRule = QuadratureRule::Rectangle;
+    bool periodic = false;
+    double rdgMax = 0.0;
+    std::string rdgFilename;
+    std::string gradientFilename;
+    std::string laplacianFilename;
+    MaskOptions mask;
+    std::string radialCenter;
+    std::string sliceSpec;
+    std::string lineSpec;
+    double radialBin = 0.1;
+    bool stream = false;
+    std::string cacheDirectory;
+    std::string buildIndexFilename;
+    std::string indexFilename;
+    bool refine = false;
+    bool spin = false;
+    std::string shardSpec;
+    std::string partialFilename;
+    bool mpi = false;
+    int slabProcesses = 0;
+    std::vector<std::string> compareFilenames;
 
     cubeFilename = argv[1];
 
@@ -64,12 +815,257 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
         }
+        else if (arg == "--bench-stencil") {
+            benchStencil = true;
+        }
+        else if (arg == "--bench-parse") {
+            benchParse = true;
+        }
+        else if (arg == "--baseline" && i + 1 < argc) {
+            baselineFilename = argv[++i];
+        }
+        else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = std::stod(argv[++i]);
+        }
+        else if (arg == "-c") {
+            checkOnly = true;
+        }
+        else if (arg == "--allow-truncated") {
+            allowTruncated = true;
+        }
+        else if (arg == "-i") {
+            interpolate = true;
+        }
+        else if (arg == "-q" && i + 1 < argc) {
+            try {
+                quadratureRule = parseQuadratureRule(argv[++i]);
+            }
+            catch (const std::exception &ex) {
+                std::cerr << "Error: " << ex.what() << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--periodic") {
+            periodic = true;
+        }
+        else if (arg == "-j" && i + 1 < argc) {
+            setWorkerCount(static_cast<unsigned>(std::stoul(argv[++i])));
+        }
+        else if (arg == "--quantize" && i + 1 < argc) {
+            quantizeError = std::stod(argv[++i]);
+        }
+        else if (arg == "--rdg-max" && i + 1 < argc) {
+            rdgMax = std::stod(argv[++i]);
+        }
+        else if (arg == "--write-rdg" && i + 1 < argc) {
+            rdgFilename = argv[++i];
+        }
+        else if (arg == "--write-gradient" && i + 1 < argc) {
+            gradientFilename = argv[++i];
+        }
+        else if (arg == "--write-laplacian" && i + 1 < argc) {
+            laplacianFilename = argv[++i];
+        }
+        else if (arg == "--mask" && i + 1 < argc) {
+            mask.file = argv[++i];
+        }
+        else if (arg == "--mask-cube" && i + 1 < argc) {
+            mask.cube = argv[++i];
+        }
+        else if (arg == "--mask-threshold" && i + 1 < argc) {
+            mask.threshold = std::stod(argv[++i]);
+        }
+        else if (arg == "--mask-atoms" && i + 1 < argc) {
+            mask.atoms = argv[++i];
+        }
+        else if (arg == "--mask-radius" && i + 1 < argc) {
+            mask.radius = std::stod(argv[++i]);
+        }
+        else if (arg == "--write-mask" && i + 1 < argc) {
+            mask.output = argv[++i];
+        }
+        else if (arg == "--radial" && i + 1 < argc) {
+            radialCenter = argv[++i];
+        }
+        else if (arg == "--cache") {
+            if (cacheDirectory.empty())
+                cacheDirectory = defaultCacheDirectory();
+        }
+        else if (arg == "--cache-dir" && i + 1 < argc) {
+            cacheDirectory = argv[++i];
+        }
+        else if (arg == "--build-index" && i + 1 < argc) {
+            buildIndexFilename = argv[++i];
+        }
+        else if (arg == "--index" && i + 1 < argc) {
+            indexFilename = argv[++i];
+        }
+        else if (arg == "--compare" && i + 1 < argc) {
+            while (i + 1 < argc && argv[i + 1][0] != '-')
+                compareFilenames.push_back(argv[++i]);
+        }
+        else if (arg == "--refine") {
+            refine = true;
+        }
+        else if (arg == "--shard" && i + 1 < argc) {
+            shardSpec = argv[++i];
+        }
+        else if (arg == "--partial" && i + 1 < argc) {
+            partialFilename = argv[++i];
+        }
+        else if (arg == "--processes" && i + 1 < argc) {
+            slabProcesses = std::stoi(argv[++i]);
+            if (slabProcesses < 1) {
+                std::cerr << "Error: --processes requires a positive number.\n";
+                return 1;
+            }
+        }
+        else if (arg == "--mpi") {
+            mpi = true;
+        }
+        else if (arg == "--spin") {
+            spin = true;
+        }
+        else if (arg == "--stream") {
+            stream = true;
+        }
+        else if (arg == "--slice" && i + 1 < argc) {
+            sliceSpec = argv[++i];
+        }
+        else if (arg == "--line" && i + 1 < argc) {
+            lineSpec = argv[++i];
+        }
+        else if (arg == "--radial-bin" && i + 1 < argc) {
+            radialBin = std::stod(argv[++i]);
+        }
+        else if ((arg == "--to-cubeb" || arg == "--to-cube") && i + 1 < argc) {
+            convertToBinary = (arg == "--to-cubeb");
+            convertFilename = argv[++i];
+        }
         else {
             std::cerr << "Error: Unknown option " << arg << "\n";
             printUsage(argv[0]);
             return 1;
         }
     }
+    const bool writesDensityFields = !rdgFilename.empty() || !gradientFilename.empty() || !laplacianFilename.empty();
+
+    if (checkOnly) {
+        try {
+            return printValidationReport(cubeFilename, validateCubeFile(cubeFilename)) ? 0 : 2;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!convertFilename.empty()) {
+        try {
+            CubeData cube = loadCube(cubeFilename, allowTruncated);
+            if (convertToBinary)
+                writeCubeBinary(cube, convertFilename);
+            else
+                writeCubeFile(cube, convertFilename);
+            std::cout << "Converted " << cubeFilename << " to " << convertFilename << "\n";
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (benchParse) {
+        try {
+            ParseBenchmark bench = benchmarkCubeParse(cubeFilename);
+            std::cout << "Parse benchmark for " << cubeFilename << " (" << bench.bytes << " bytes, " << bench.values
+                      << " values):\n"
+                      << "  Best time:   " << bench.bestSeconds << " s\n"
+                      << "  Throughput:  " << bench.megabytesPerSecond << " MB/s\n";
+            return baselineFilename.empty() ? 0 : checkParseBaseline(baselineFilename, bench, tolerance);
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (benchStencil) {
+        try {
+            CubeData cube = loadCube(cubeFilename, allowTruncated);
+            StencilBenchmark bench = benchmarkStencilLayouts(cube.values, cube.header.dims);
+            std::cout << "Stencil benchmark for " << cubeFilename << " (" << cube.header.dims[0] << " x "
+                      << cube.header.dims[1] << " x " << cube.header.dims[2] << ", " << workerCount()
+                      << " threads):\n"
+                      << "  Flat x-major layout:   " << bench.linearMVoxelsPerSecond << " Mvoxel/s\n"
+                      << "  Bricked 8^3 layout:    " << bench.brickedMVoxelsPerSecond << " Mvoxel/s\n"
+                      << "  Layout conversion:     " << bench.conversionSeconds << " s\n"
+                      << "  Checksum difference:   " << bench.checksumDifference << "\n";
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!buildIndexFilename.empty()) {
+        try {
+            CubeData cube = loadCube(cubeFilename, allowTruncated);
+            writeMassIndex(buildMassIndex(cube, hashFile(cubeFilename)), buildIndexFilename);
+            std::cout << "Wrote cumulative-mass index of " << cubeFilename << " to " << buildIndexFilename << "\n";
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!compareFilenames.empty()) {
+        if (!usePercentage || useIsovalue) {
+            std::cerr << "Error: --compare requires -p (percentage).\n";
+            return 1;
+        }
+        try {
+            std::vector<std::string> filenames{cubeFilename};
+            filenames.insert(filenames.end(), compareFilenames.begin(), compareFilenames.end());
+            printComparison(filenames, compareCubes(filenames, inputValue, positive, interpolate, allowTruncated),
+                            inputValue);
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!radialCenter.empty()) {
+        try {
+            CubeData cube = loadCube(cubeFilename, allowTruncated);
+            printRadialProfiles(cube, radialCenter, radialBin, usePercentage, inputValue);
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!sliceSpec.empty() || !lineSpec.empty()) {
+        try {
+            if (!sliceSpec.empty() && !lineSpec.empty())
+                throw std::runtime_error("--slice and --line cannot be combined.");
+            printGridSection(cubeFilename, sliceSpec.empty() ? lineSpec : sliceSpec, !sliceSpec.empty(),
+                             cacheDirectory);
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
 
     // Exactly one of -p or -v must be specified.
     if (usePercentage == useIsovalue) {
@@ -78,9 +1074,141 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // Shard mode: the first argument is a manifest of cube files.
+    if (!shardSpec.empty()) {
+        if (partialFilename.empty()) {
+            std::cerr << "Error: --shard requires --partial <output_file>.\n";
+            return 1;
+        }
+        try {
+            size_t shard = 0, shardCount = 1;
+            parseShardSpec(shardSpec, shard, shardCount);
+            Manifest manifest = readManifest(cubeFilename);
+            ShardPartial partial = runShard(manifest, shard, shardCount,
+                                            {usePercentage, inputValue, positive, interpolate, allowTruncated});
+            writeShardPartial(partial, partialFilename);
+            size_t failed = std::count_if(partial.entries.begin(), partial.entries.end(),
+                                          [](const ShardEntry &e) { return !e.ok; });
+            std::cout << "Shard " << shard << "/" << shardCount << ": " << partial.entries.size() << " of "
+                      << manifest.files.size() << " cubes processed, " << failed << " failed; written to "
+                      << partialFilename << "\n";
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    // Distributed mode: every process holds one slab of the grid.
+    if (mpi || slabProcesses > 0) {
+        if (interpolate || spin || stream || quadratureRule != QuadratureRule::Rectangle || rdgMax > 0.0 ||
+            writesDensityFields || quantizeError > 0.0 || !indexFilename.empty() || !cacheDirectory.empty() ||
+            mask.any() ||
+            (mpi && slabProcesses > 0)) {
+            std::cerr << "Error: --mpi and --processes support -p/-v with -s and --allow-truncated only.\n";
+            return 1;
+        }
+        auto analyse = [&](ProcessGroup &group) {
+            GridSlab slab = loadGridSlab(cubeFilename, group.rank(), group.size(), allowTruncated);
+            DistributedResult result = usePercentage
+                                           ? distributedIsovalueFromPercentage(slab, group, inputValue, positive)
+                                           : distributedPercentageFromIsovalue(slab, group, inputValue, positive);
+            if (group.rank() == 0)
+                printDistributedResult(cubeFilename, slab, result, group.size(), usePercentage, inputValue);
+            return 0;
+        };
+        std::unique_ptr<ProcessGroup> group;
+        try {
+            if (slabProcesses > 0)
+                return runLocalProcessGroup(slabProcesses, analyse);
+            group = createMpiProcessGroup(argc, argv);
+            return analyse(*group);
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            if (group)
+                group->abort();
+            return 1;
+        }
+    }
+
+    // Consult the result cache before any parsing. Runs that write files are not cached.
+    std::unique_ptr<ResultRecorder> recorder;
+    if (!cacheDirectory.empty() && !writesDensityFields && mask.output.empty()) {
+        try {
+            std::ostringstream query;
+            query << std::setprecision(17) << (usePercentage ? "p=" : "v=") << inputValue << ";positive=" << positive
+                  << ";interpolate=" << interpolate << ";quadrature=" << static_cast<int>(quadratureRule)
+                  << ";periodic=" << periodic << ";rdgMax=" << rdgMax << ";quantize=" << quantizeError
+                  << ";stream=" << stream << ";allowTruncated=" << allowTruncated << ";spin=" << spin
+                  << ";mask=" << mask.describe() << ";index="
+                  << (indexFilename.empty() ? std::string("none") : std::to_string(hashFile(indexFilename)))
+                  << ";refine=" << refine;
+            std::string key = resultCacheKey(hashFile(cubeFilename), query.str());
+            std::string cached;
+            if (loadCachedResult(cacheDirectory, key, cubeFilename, cached)) {
+                std::cout << cached;
+                return 0;
+            }
+            recorder = std::make_unique<ResultRecorder>(cacheDirectory, key, cubeFilename);
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (!indexFilename.empty()) {
+        if (interpolate || stream || spin || quadratureRule != QuadratureRule::Rectangle || rdgMax > 0.0 ||
+            writesDensityFields || quantizeError > 0.0 || mask.any()) {
+            std::cerr << "Error: --index supports -p/-v with the default quadrature only.\n";
+            if (recorder)
+                recorder->discard();
+            return 1;
+        }
+        try {
+            MassIndex index = readMassIndex(indexFilename);
+            if (index.contentHash != hashFile(cubeFilename))
+                throw std::runtime_error("The index " + indexFilename + " was not built from " + cubeFilename + ".");
+            printIndexQuery(cubeFilename, index, usePercentage, inputValue, positive, refine, allowTruncated);
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            if (recorder)
+                recorder->discard();
+            return 1;
+        }
+    }
+
+    if (stream) {
+        if (!useIsovalue || spin || quadratureRule != QuadratureRule::Rectangle || rdgMax > 0.0 ||
+            writesDensityFields || quantizeError > 0.0 || mask.any()) {
+            std::cerr << "Error: --stream supports -v with the default quadrature only.\n";
+            if (recorder)
+                recorder->discard();
+            return 1;
+        }
+        try {
+            if (detectVolumetricFormat(cubeFilename) != VolumetricFormat::Cube)
+                throw std::runtime_error("--stream reads text cube files only.");
+            StreamingResult result =
+                streamPercentageFromIsovalue(cubeFilename, inputValue, positive, interpolate, allowTruncated);
+            printStreamingResult(cubeFilename, result, inputValue);
+            return 0;
+        }
+        catch (const std::exception &ex) {
+            std::cerr << "Exception encountered: " << ex.what() << "\n";
+            if (recorder)
+                recorder->discard();
+            return 1;
+        }
+    }
+
     try {
         // Read the cube file.
-        CubeData cube = readCubeFile(cubeFilename);
+        CubeData cube = loadCube(cubeFilename, allowTruncated);
         // Compute voxel volume using the grid's axis vectors.
         double voxelVolume = computeVoxelVolume(cube.header);
         // Determine the native unit.
@@ -94,6 +1222,48 @@ int main(int argc, char *argv[]) {
         std::cout << "Grid dimensions: " << cube.header.dims[0] << " x "
                   << cube.header.dims[1] << " x " << cube.header.dims[2] << "\n";
         std::cout << "Voxel volume: " << voxelVolume << " " << nativeUnit << "^3\n";
+        size_t expectedPoints = static_cast<size_t>(cube.header.dims[0]) * cube.header.dims[1] * cube.header.dims[2];
+        if (cube.values.size() < expectedPoints)
+            std::cout << "Warning: truncated data; processing the first " << cube.values.size()
+                      << " of " << expectedPoints << " grid points.\n";
+
+        // Derived fields: optionally write them and restrict the grid to the low-gradient region.
+        if (rdgMax > 0.0 || writesDensityFields) {
+            if (cube.header.isOrbital)
+                throw std::runtime_error("Derived density fields require density data.");
+            DensityFieldSelection selection;
+            selection.gradient = !gradientFilename.empty();
+            selection.laplacian = !laplacianFilename.empty();
+            selection.reducedGradient = rdgMax > 0.0 || !rdgFilename.empty();
+            DensityFields fields = computeDensityFields(cube, periodic, selection);
+            if (!rdgFilename.empty())
+                writeReducedGradientCube(cube, fields, rdgFilename);
+            if (!gradientFilename.empty())
+                writeGradientCubes(cube, fields, gradientFilename);
+            if (!laplacianFilename.empty())
+                writeLaplacianCube(cube, fields, laplacianFilename);
+            if (rdgMax > 0.0)
+                restrictToReducedGradient(cube, fields, rdgMax, voxelVolume);
+        }
+
+        // Region masks: the grid outside the region is set to zero.
+        if (mask.any())
+            restrictToRegionMask(cube, mask, voxelVolume);
+        else if (!mask.output.empty())
+            throw std::runtime_error("--write-mask requires --mask, --mask-cube or --mask-atoms.");
+
+        if (spin && (cube.header.isOrbital || quadratureRule != QuadratureRule::Rectangle))
+            throw std::runtime_error("--spin requires density data and the default quadrature.");
+
+        // Higher-order quadrature weights every grid point; handled separately.
+        if (quadratureRule != QuadratureRule::Rectangle) {
+            QuadratureWeights weights = buildQuadratureWeights(cube.header, quadratureRule, periodic);
+            printWeightedIntegration(cube, weights, usePercentage, inputValue, positive, interpolate, voxelVolume,
+                                     nativeIsAngstrom);
+            return 0;
+        }
+
+        GridCoordinates coords = buildGridCoordinates(cube.header);
 
         // Compute the total integrated density.
         double totalIntegrated = 0.0;
@@ -112,82 +1282,79 @@ int main(int argc, char *argv[]) {
             std::cout << "Total integrated electron density: " << totalIntegrated << "\n";
         }
 
-        // For orbital data, if sign is not explicitly chosen, decide automatically.
-        if (cube.header.isOrbital) {
-            double posTotal = 0.0, negTotal = 0.0;
-            for (double v : cube.values) {
-                if (v > 0)
-                    posTotal += v * v;
-                else if (v < 0)
-                    negTotal += v * v;
-            }
-            if (!((positive && posTotal > 0) || (!positive && negTotal > 0))) {
-                positive = (posTotal >= std::abs(negTotal));
-            }
-        }
-
         // Depending on whether a percentage or a specific isovalue was provided, compute the mapping.
-        if (usePercentage) {
+        if (spin) {
+            // Both signs at once; -s does not apply.
+            SpinDensityReport report = usePercentage
+                                           ? computeSpinDensityFromPercentage(cube.values, inputValue, interpolate)
+                                           : computeSpinDensityFromIsovalue(cube.values, inputValue, interpolate);
+            printSpinDensity(report, inputValue, usePercentage, voxelVolume, nativeIsAngstrom, nativeUnit, convUnit);
+        }
+        else if (usePercentage) {
             if (cube.header.isOrbital) {
                 std::cout << "Integrating (in orbital mode) to reach " << inputValue << "% of the total quantity...\n";
-                double isovalue_native = computeIsovalueFromPercentage_Orbital(cube.values, inputValue, positive);
+                // One sort of a sign-partitioned buffer gives the combined and per-phase results.
+                OrbitalPhaseReport phases = computeOrbitalPhasesFromPercentage(cube.values, inputValue, interpolate);
+                double isovalue_native = phases.combined.isovalue;
                 double isovalue_converted = convertOrbital(isovalue_native, nativeIsAngstrom);
                 std::cout << "Isovalue (orbital) corresponding to " << inputValue << "%:\n"
                           << "  " << isovalue_native << " (native, electrons/" << nativeUnit << "^(3/2))\n"
                           << "  " << isovalue_converted << " (converted, electrons/" << convUnit << "^(3/2))\n";
 
-                double integratedAbove = 0.0;
-                for (double v : cube.values) {
-                    if (v * v >= isovalue_native * isovalue_native)
-                        integratedAbove += v * v;
-                }
-                integratedAbove *= voxelVolume;
-                std::cout << "Integrated orbital density above threshold (native): " << integratedAbove << "\n";
-                double enclosedPercentage = computePercentageFromIsovalue_Orbital(cube.values, isovalue_native, positive);
+                RegionMoments region = computeRegionMoments(cube, coords, isovalue_native, positive);
+                std::cout << "Integrated orbital density above threshold (native): " << region.mass << "\n";
+                double enclosedPercentage = computePercentageFromIsovalue_Orbital(cube.values, isovalue_native, positive, interpolate);
                 std::cout << "Computed percentage of total orbital density above threshold: "
                           << enclosedPercentage << "%\n";
+                printOrbitalPhases(phases, inputValue, true, nativeUnit);
+                printRegionMoments(region, nativeUnit);
             }
             else {
                 std::cout << "Integrating (in density mode) to reach " << inputValue << "% of the total quantity...\n";
-                double isovalue_native = computeIsovalueFromPercentage_Density(cube.values, inputValue, positive);
+                double isovalue_native = computeIsovalueFromPercentage_Density(cube.values, inputValue, positive, interpolate);
                 double isovalue_converted = convertDensity(isovalue_native, nativeIsAngstrom);
                 std::cout << "Isovalue (density) corresponding to " << inputValue << "%:\n"
                           << "  " << isovalue_native << " (native, electrons/" << nativeUnit << "^3)\n"
                           << "  " << isovalue_converted << " (converted, electrons/" << convUnit << "^3)\n";
 
-                double integratedAbove = 0.0;
-                for (double v : cube.values) {
-                    if ((positive && v >= isovalue_native) || (!positive && v <= isovalue_native))
-                        integratedAbove += v;
-                }
-                integratedAbove *= voxelVolume;
-                std::cout << "Integrated electron density above threshold (native): " << integratedAbove << "\n";
-                double enclosedPercentage = computePercentageFromIsovalue_Density(cube.values, isovalue_native, positive);
+                RegionMoments region = computeRegionMoments(cube, coords, isovalue_native, positive);
+                std::cout << "Integrated electron density above threshold (native): " << region.mass << "\n";
+                double enclosedPercentage = computePercentageFromIsovalue_Density(cube.values, isovalue_native, positive, interpolate);
                 std::cout << "Computed percentage of total electron density above threshold: "
                           << enclosedPercentage << "%\n";
+                printRegionMoments(region, nativeUnit);
             }
         }
         else {
             if (cube.header.isOrbital) {
-                double percentage = computePercentageFromIsovalue_Orbital(cube.values, inputValue, positive);
+                double percentage = computePercentageFromIsovalue_Orbital(cube.values, inputValue, positive, interpolate);
                 std::cout << "For orbital data, the percentage of total charge enclosed by isovalue " 
                           << inputValue << " (electrons/" << nativeUnit << "^(3/2)) is: " 
                           << percentage << "%\n";
                 std::cout << "Converted isovalue: " << convertOrbital(inputValue, nativeIsAngstrom)
                           << " electrons/" << convUnit << "^(3/2)\n";
+                printOrbitalPhases(computeOrbitalPhasesFromIsovalue(cube.values, inputValue, interpolate),
+                                   inputValue, false, nativeUnit);
+                printRegionMoments(computeRegionMoments(cube, coords, inputValue, positive), nativeUnit);
             }
             else {
-                double percentage = computePercentageFromIsovalue_Density(cube.values, inputValue, positive);
+                double percentage = computePercentageFromIsovalue_Density(cube.values, inputValue, positive, interpolate);
                 std::cout << "For density data, the percentage of total charge enclosed by isovalue " 
                           << inputValue << " (electrons/" << nativeUnit << "^3) is: " 
                           << percentage << "%\n";
                 std::cout << "Converted isovalue: " << convertDensity(inputValue, nativeIsAngstrom)
                           << " electrons/" << convUnit << "^3\n";
+                printRegionMoments(computeRegionMoments(cube, coords, inputValue, positive), nativeUnit);
             }
         }
+
+        if (quantizeError > 0.0)
+            printQuantizationReport(cube, usePercentage, inputValue, positive, quantizeError);
     }
     catch (const std::exception &ex) {
         std::cerr << "Exception encountered: " << ex.what() << "\n";
+        if (recorder)
+            recorder->discard();
         return 1;
     }
 
@@ -0,0 +1,70 @@
+/*
+ * CubeIsoFinder
+ * File: mapped_file.cpp
+ *
+ * Description:
+ *   Implements the read-only memory-mapped file view.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "mapped_file.hpp"
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CUBEISOFINDER_HAVE_MMAP 1
+#endif
+
+MappedFile::MappedFile(const std::string &filename) {
+#ifdef CUBEISOFINDER_HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Error opening file: " + filename);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Error reading file size: " + filename);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Error mapping file: " + filename);
+        }
+        // The data block is scanned front to back exactly once.
+        ::madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char *>(p);
+        mapped_ = true;
+    }
+    ::close(fd);
+#else
+    std::ifstream infile(filename, std::ios::binary | std::ios::ate);
+    if (!infile)
+        throw std::runtime_error("Error opening file: " + filename);
+    size_ = static_cast<size_t>(infile.tellg());
+    infile.seekg(0);
+    buffer_.resize(size_);
+    if (size_ > 0 && !infile.read(buffer_.data(), static_cast<std::streamsize>(size_)))
+        throw std::runtime_error("Error reading file: " + filename);
+    data_ = buffer_.data();
+#endif
+    if (size_ == 0)
+        data_ = "";
+}
+
+MappedFile::~MappedFile() {
+#ifdef CUBEISOFINDER_HAVE_MMAP
+    if (mapped_)
+        ::munmap(const_cast<char *>(data_), size_);
+#endif
+}
@@ -0,0 +1,395 @@
+/*
+ * CubeIsoFinder
+ * File: mass_index.cpp
+ *
+ * Description:
+ *   Implements building, storing and querying the cumulative-mass index.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "mass_index.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+const char kIndexMagic[8] = {'C', 'U', 'B', 'E', 'I', 'X', '1', '\n'};
+
+// Mass order, selection and mass of the points of one curve.
+struct CurveOrder {
+    MassCurve curve;
+
+    bool selected(double v) const {
+        return curve == MassCurve::Orbital || (curve == MassCurve::Positive ? v > 0 : v < 0);
+    }
+    double mass(double v) const { return curve == MassCurve::Orbital ? v * v : std::abs(v); }
+    // Strict total order: true if a comes before b.
+    bool operator()(double a, double b) const {
+        if (curve == MassCurve::Positive)
+            return a > b;
+        if (curve == MassCurve::Negative)
+            return a < b;
+        return a * a > b * b || (a * a == b * b && a > b);
+    }
+    bool sameLevel(double a, double b) const { return curve == MassCurve::Orbital ? a * a == b * b : a == b; }
+};
+
+// Range [begin, end) of the points of knot k on the curve.
+size_t knotBegin(const MassIndexCurve &c, size_t k) { return k * c.knotSize; }
+size_t knotEnd(const MassIndexCurve &c, size_t k) { return std::min(c.count, (k + 1) * c.knotSize); }
+size_t knotCount(const MassIndexCurve &c) { return c.first.size(); }
+// Cumulative mass before knot k and through its last point.
+double massBefore(const MassIndexCurve &c, size_t k) { return c.blockPrefix[k] + c.runningBefore[k]; }
+double massThrough(const MassIndexCurve &c, size_t k) {
+    return k + 1 < knotCount(c) ? massBefore(c, k + 1) : c.total;
+}
+
+MassIndexCurve buildCurve(const std::vector<double> &values, MassCurve curve) {
+    const CurveOrder order{curve};
+    std::vector<double> sorted;
+    for (double v : values)
+        if (order.selected(v))
+            sorted.push_back(v);
+    parallelSort(sorted, order);
+
+    MassIndexCurve c;
+    c.count = sorted.size();
+    if (c.count == 0)
+        return c;
+    c.knotSize = minKnotSize;
+    while (c.count > c.knotSize * maxKnots)
+        c.knotSize *= 2;
+    const size_t knots = (c.count + c.knotSize - 1) / c.knotSize;
+    c.blockPrefix.resize(knots);
+    c.runningBefore.resize(knots);
+    c.first.resize(knots);
+    c.last.resize(knots);
+    c.headTies.resize(knots);
+    c.levelValue.resize(knots);
+    // Knot sizes divide reductionBlock or are multiples of it, so a knot never starts
+    // inside another block than the one holding its first point.
+    const size_t blocks = (c.count + reductionBlock - 1) / reductionBlock;
+    std::vector<double> partial(blocks, 0.0);
+    parallelFor(blocks, [&](size_t b) {
+        const size_t end = std::min(c.count, (b + 1) * reductionBlock);
+        double s = 0.0;
+        for (size_t i = b * reductionBlock; i < end; ++i) {
+            if (i % c.knotSize == 0)
+                c.runningBefore[i / c.knotSize] = s;
+            s += order.mass(sorted[i]);
+        }
+        partial[b] = s;
+    });
+    std::vector<double> prefix(blocks + 1, 0.0);
+    for (size_t b = 0; b < blocks; ++b)
+        prefix[b + 1] = prefix[b] + partial[b];
+    size_t groupBegin = 0; // Start of the level containing the current knot start.
+    for (size_t k = 0; k < knots; ++k) {
+        const size_t begin = knotBegin(c, k), end = knotEnd(c, k);
+        c.blockPrefix[k] = prefix[begin / reductionBlock];
+        c.first[k] = sorted[begin];
+        c.last[k] = sorted[end - 1];
+        size_t ties = 1;
+        while (begin + ties < end && sorted[begin + ties] == sorted[begin])
+            ++ties;
+        c.headTies[k] = ties;
+        while (!order.sameLevel(sorted[groupBegin], sorted[begin]))
+            ++groupBegin;
+        c.levelValue[k] = sorted[groupBegin];
+    }
+    c.total = prefix[blocks];
+    return c;
+}
+
+// The points of knot k in mass order, recovered from the grid: the values in the knot's
+// magnitude range are sorted, and the knot starts after all points ordered before its
+// first value plus those of its leading ties that belong to earlier knots. The sorted
+// range is returned in band, the knot occupies [offset, offset + length).
+void recoverKnot(const MassIndexCurve &c, MassCurve curve, size_t k, const std::vector<double> &values,
+                 std::vector<double> &band, size_t &offset) {
+    const CurveOrder order{curve};
+    const double hi = std::abs(c.first[k]), lo = std::abs(c.last[k]);
+    band.clear();
+    for (double v : values)
+        if (order.selected(v) && std::abs(v) <= hi && std::abs(v) >= lo)
+            band.push_back(v);
+    parallelSort(band, order);
+    size_t throughFirst = static_cast<size_t>(std::upper_bound(band.begin(), band.end(), c.first[k], order) -
+                                              band.begin());
+    const size_t length = knotEnd(c, k) - knotBegin(c, k);
+    if (throughFirst < c.headTies[k] || throughFirst - c.headTies[k] + length > band.size())
+        throw std::runtime_error("Error: The index does not match the grid.");
+    offset = throughFirst - c.headTies[k];
+}
+
+const MassIndexCurve &nonEmptyCurve(const MassIndex &index, MassCurve curve) {
+    const MassIndexCurve &c = index.curves[static_cast<int>(curve)];
+    if (c.count == 0 || c.total == 0.0)
+        throw std::runtime_error("Total charge for the requested sign is zero.");
+    return c;
+}
+
+template <typename T>
+void writePod(std::ofstream &out, const T &value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void writeArray(std::ofstream &out, const std::vector<T> &values) {
+    out.write(reinterpret_cast<const char *>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+}
+
+void writeString(std::ofstream &out, const std::string &s) {
+    writePod(out, static_cast<uint32_t>(s.size()));
+    out.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+// Bounds-checked sequential reader over a mapped file.
+struct ByteReader {
+    const char *data;
+    size_t size;
+    size_t pos;
+
+    void need(size_t n) const {
+        if (n > size - pos)
+            throw std::runtime_error("Error: Unexpected end of index file.");
+    }
+    template <typename T>
+    T pod() {
+        need(sizeof(T));
+        T value;
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    template <typename T>
+    std::vector<T> array(size_t count) {
+        if (count > (size - pos) / sizeof(T))
+            throw std::runtime_error("Error: Unexpected end of index file.");
+        std::vector<T> values(count);
+        std::memcpy(values.data(), data + pos, count * sizeof(T));
+        pos += count * sizeof(T);
+        return values;
+    }
+    std::string str() {
+        uint32_t len = pod<uint32_t>();
+        need(len);
+        std::string s(data + pos, len);
+        pos += len;
+        return s;
+    }
+};
+
+} // namespace
+
+MassIndex buildMassIndex(const CubeData &cube, uint64_t contentHash) {
+    MassIndex index;
+    index.contentHash = contentHash;
+    index.header = cube.header;
+    index.header.atoms.clear();
+    if (cube.header.isOrbital) {
+        index.curves[static_cast<int>(MassCurve::Orbital)] = buildCurve(cube.values, MassCurve::Orbital);
+    }
+    else {
+        index.curves[static_cast<int>(MassCurve::Positive)] = buildCurve(cube.values, MassCurve::Positive);
+        index.curves[static_cast<int>(MassCurve::Negative)] = buildCurve(cube.values, MassCurve::Negative);
+    }
+    return index;
+}
+
+void writeMassIndex(const MassIndex &index, const std::string &filename) {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Error: Cannot open file " + filename + " for writing.");
+    const CubeHeader &h = index.header;
+    out.write(kIndexMagic, sizeof(kIndexMagic));
+    writePod(out, index.contentHash);
+    writeString(out, h.comment1);
+    writeString(out, h.comment2);
+    writeString(out, h.calcType);
+    writePod(out, static_cast<uint8_t>(h.isOrbital));
+    for (int c = 0; c < 3; ++c)
+        writePod(out, h.origin[c]);
+    for (int a = 0; a < 3; ++a) {
+        writePod(out, static_cast<int32_t>(h.dims[a]));
+        for (int c = 0; c < 4; ++c)
+            writePod(out, h.axisVectors[a][c]);
+    }
+    for (const MassIndexCurve &c : index.curves) {
+        writePod(out, static_cast<uint64_t>(c.count));
+        writePod(out, c.total);
+        writePod(out, static_cast<uint64_t>(c.knotSize));
+        writePod(out, static_cast<uint64_t>(knotCount(c)));
+        writeArray(out, c.blockPrefix);
+        writeArray(out, c.runningBefore);
+        writeArray(out, c.first);
+        writeArray(out, c.last);
+        writeArray(out, c.headTies);
+        writeArray(out, c.levelValue);
+    }
+    if (!out)
+        throw std::runtime_error("Error: Failed to write " + filename + ".");
+}
+
+MassIndex readMassIndex(const std::string &filename) {
+    MappedFile file(filename);
+    if (file.size() < sizeof(kIndexMagic) || std::memcmp(file.data(), kIndexMagic, sizeof(kIndexMagic)) != 0)
+        throw std::runtime_error("Error: " + filename + " is not a cumulative-mass index file.");
+    ByteReader r{file.data(), file.size(), sizeof(kIndexMagic)};
+    MassIndex index;
+    CubeHeader &h = index.header;
+    index.contentHash = r.pod<uint64_t>();
+    h.comment1 = r.str();
+    h.comment2 = r.str();
+    h.calcType = r.str();
+    h.isOrbital = r.pod<uint8_t>() != 0;
+    h.numAtoms = 0;
+    for (int c = 0; c < 3; ++c)
+        h.origin[c] = r.pod<double>();
+    for (int a = 0; a < 3; ++a) {
+        h.dims[a] = r.pod<int32_t>();
+        for (int c = 0; c < 4; ++c)
+            h.axisVectors[a][c] = r.pod<double>();
+    }
+    for (MassIndexCurve &c : index.curves) {
+        c.count = r.pod<uint64_t>();
+        c.total = r.pod<double>();
+        c.knotSize = r.pod<uint64_t>();
+        size_t knots = r.pod<uint64_t>();
+        if (c.count > 0 && (c.knotSize == 0 || knots != (c.count + c.knotSize - 1) / c.knotSize))
+            throw std::runtime_error("Error: Corrupted index file " + filename + ".");
+        c.blockPrefix = r.array<double>(knots);
+        c.runningBefore = r.array<double>(knots);
+        c.first = r.array<double>(knots);
+        c.last = r.array<double>(knots);
+        c.headTies = r.array<uint64_t>(knots);
+        c.levelValue = r.array<double>(knots);
+    }
+    return index;
+}
+
+IndexAnswer isovalueFromIndex(const MassIndex &index, MassCurve curve, double percent,
+                              const std::vector<double> *values) {
+    const MassIndexCurve &c = nonEmptyCurve(index, curve);
+    const CurveOrder order{curve};
+    const double target = (percent / 100.0) * c.total;
+    // First knot whose cumulative mass reaches the target (the last knot if none does),
+    // which holds the first block findThresholdCrossing would select.
+    const size_t knots = knotCount(c);
+    size_t k = 0;
+    {
+        size_t lo = 0, hi = knots - 1;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (massThrough(c, mid) >= target)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        k = lo;
+    }
+    IndexAnswer answer;
+    // Orbital knots mix signs within a level, so they are bracketed by magnitude.
+    const double first = curve == MassCurve::Orbital ? std::abs(c.first[k]) : c.first[k];
+    const double last = curve == MassCurve::Orbital ? std::abs(c.last[k]) : c.last[k];
+    answer.lower = std::min(first, last);
+    answer.upper = std::max(first, last);
+    if (order.sameLevel(c.first[k], c.last[k])) {
+        // The knot is a single level; for orbitals the level's reported amplitude is known.
+        answer.value = curve == MassCurve::Orbital ? c.levelValue[k] : c.first[k];
+        answer.exact = true;
+        return answer;
+    }
+    if (!values) {
+        double span = massThrough(c, k) - massBefore(c, k);
+        double fraction = span > 0.0 ? std::clamp((target - massBefore(c, k)) / span, 0.0, 1.0) : 0.0;
+        answer.value = first + fraction * (last - first);
+        answer.exact = false;
+        return answer;
+    }
+
+    // Refinement: repeat findThresholdCrossing's block scan over the recovered knot.
+    std::vector<double> band;
+    size_t offset = 0;
+    recoverKnot(c, curve, k, *values, band, offset);
+    const size_t length = knotEnd(c, k) - knotBegin(c, k);
+    size_t crossing = offset + length - 1;
+    double prefix = c.blockPrefix[k];
+    double running = c.runningBefore[k];
+    for (size_t j = 0; j < length; ++j) {
+        if (j > 0 && (knotBegin(c, k) + j) % reductionBlock == 0) {
+            prefix += running;
+            running = 0.0;
+        }
+        running += order.mass(band[offset + j]);
+        if (prefix + running >= target) {
+            crossing = offset + j;
+            break;
+        }
+    }
+    // The reported value is that of the first point of the crossing level.
+    size_t groupBegin = crossing;
+    while (groupBegin > 0 && order.sameLevel(band[groupBegin - 1], band[crossing]))
+        --groupBegin;
+    answer.value = curve == MassCurve::Orbital ? band[groupBegin] : band[crossing];
+    answer.exact = true;
+    return answer;
+}
+
+IndexAnswer percentageFromIndex(const MassIndex &index, MassCurve curve, double isovalue,
+                                const std::vector<double> *values) {
+    const MassIndexCurve &c = nonEmptyCurve(index, curve);
+    const CurveOrder order{curve};
+    auto enclosed = [&](double v) {
+        if (curve == MassCurve::Orbital)
+            return v * v >= isovalue * isovalue;
+        return curve == MassCurve::Positive ? v >= isovalue : v <= isovalue;
+    };
+    // The enclosed points form a prefix of the curve; find the first knot not fully enclosed.
+    const size_t knots = knotCount(c);
+    size_t lo = 0, hi = knots;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (enclosed(c.last[mid]))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    const size_t k = lo;
+    IndexAnswer answer;
+    if (k == knots || !enclosed(c.first[k])) {
+        double mass = k == knots ? c.total : massBefore(c, k);
+        answer.value = answer.lower = answer.upper = mass / c.total * 100.0;
+        answer.exact = true;
+        return answer;
+    }
+    answer.lower = massBefore(c, k) / c.total * 100.0;
+    answer.upper = massThrough(c, k) / c.total * 100.0;
+    if (!values) {
+        double hiLevel = std::abs(c.first[k]), loLevel = std::abs(c.last[k]);
+        double fraction = hiLevel > loLevel ? (hiLevel - std::abs(isovalue)) / (hiLevel - loLevel) : 0.0;
+        answer.value = answer.lower + std::clamp(fraction, 0.0, 1.0) * (answer.upper - answer.lower);
+        answer.exact = false;
+        return answer;
+    }
+    std::vector<double> band;
+    size_t offset = 0;
+    recoverKnot(c, curve, k, *values, band, offset);
+    const size_t length = knotEnd(c, k) - knotBegin(c, k);
+    double mass = massBefore(c, k);
+    for (size_t i = offset; i < offset + length && enclosed(band[i]); ++i)
+        mass += order.mass(band[i]);
+    answer.value = mass / c.total * 100.0;
+    answer.exact = true;
+    return answer;
+}
@@ -0,0 +1,61 @@
+/*
+ * CubeIsoFinder
+ * File: mpi_process_group.cpp
+ *
+ * Description:
+ *   Implements the MPI process group. Only compiled when CUBEISOFINDER_MPI is enabled.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "distributed.hpp"
+#include <mpi.h>
+#include <stdexcept>
+
+namespace {
+
+class MpiProcessGroup : public ProcessGroup {
+public:
+    MpiProcessGroup(int &argc, char **&argv) {
+        int initialized = 0;
+        MPI_Initialized(&initialized);
+        if (!initialized)
+            MPI_Init(&argc, &argv);
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+        MPI_Comm_size(MPI_COMM_WORLD, &size_);
+    }
+
+    ~MpiProcessGroup() override {
+        int finalized = 0;
+        MPI_Finalized(&finalized);
+        if (!finalized)
+            MPI_Finalize();
+    }
+
+    void abort() override { MPI_Abort(MPI_COMM_WORLD, 1); }
+
+    int rank() const override { return rank_; }
+    int size() const override { return size_; }
+
+    std::vector<double> allGather(const std::vector<double> &local) override {
+        std::vector<double> all(local.size() * static_cast<size_t>(size_));
+        if (MPI_Allgather(local.data(), static_cast<int>(local.size()), MPI_DOUBLE, all.data(),
+                          static_cast<int>(local.size()), MPI_DOUBLE, MPI_COMM_WORLD) != MPI_SUCCESS)
+            throw std::runtime_error("MPI_Allgather failed.");
+        return all;
+    }
+
+private:
+    int rank_ = 0;
+    int size_ = 1;
+};
+
+} // namespace
+
+std::unique_ptr<ProcessGroup> createMpiProcessGroup(int &argc, char **&argv) {
+    return std::make_unique<MpiProcessGroup>(argc, argv);
+}
@@ -0,0 +1,154 @@
+/*
+ * CubeIsoFinder
+ * File: quadrature.cpp
+ *
+ * Description:
+ *   Implements separable quadrature weights and weighted integration.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "quadrature.hpp"
+#include "parallel.hpp"
+#include "threshold_search.hpp"
+#include <cmath>
+#include <stdexcept>
+
+QuadratureRule parseQuadratureRule(const std::string &name) {
+    if (name == "rect")
+        return QuadratureRule::Rectangle;
+    if (name == "trapezoid")
+        return QuadratureRule::Trapezoid;
+    if (name == "simpson")
+        return QuadratureRule::Simpson;
+    throw std::runtime_error("Unknown quadrature rule: " + name + " (use rect, trapezoid or simpson).");
+}
+
+std::vector<double> quadratureAxisWeights(int n, QuadratureRule rule, bool periodic) {
+    std::vector<double> w(static_cast<size_t>(std::max(n, 0)), 1.0);
+    if (n < 2 || rule == QuadratureRule::Rectangle)
+        return w;
+    if (periodic) {
+        // Every point is interior; only Simpson on an even number of points differs.
+        if (rule == QuadratureRule::Simpson && n % 2 == 0)
+            for (int i = 0; i < n; ++i)
+                w[i] = (i % 2 == 0) ? 4.0 / 3.0 : 2.0 / 3.0;
+        return w;
+    }
+    if (rule == QuadratureRule::Trapezoid || n == 2) {
+        w[0] = w[n - 1] = 0.5;
+        return w;
+    }
+    // Simpson's rule needs an odd number of points; with an even count the last
+    // interval is integrated with the trapezoid rule.
+    int m = (n % 2 == 1) ? n : n - 1;
+    for (int i = 0; i < m; ++i)
+        w[i] = (i == 0 || i == m - 1) ? 1.0 / 3.0 : (i % 2 == 1 ? 4.0 / 3.0 : 2.0 / 3.0);
+    if (m < n) {
+        w[m - 1] += 0.5;
+        w[n - 1] = 0.5;
+    }
+    return w;
+}
+
+QuadratureWeights buildQuadratureWeights(const CubeHeader &header, QuadratureRule rule, bool periodic) {
+    QuadratureWeights weights;
+    for (int a = 0; a < 3; ++a)
+        weights.axis[a] = quadratureAxisWeights(header.dims[a], rule, periodic);
+    weights.nz = static_cast<size_t>(std::max(header.dims[2], 1));
+    weights.rowWeights.reserve(weights.axis[0].size() * weights.axis[1].size());
+    for (double wx : weights.axis[0])
+        for (double wy : weights.axis[1])
+            weights.rowWeights.push_back(wx * wy);
+    return weights;
+}
+
+// Sum over z-rows: each row is a contiguous dot product with the z weights, scaled by the
+// row weight. Row sums are combined in row order, so the result is thread-independent.
+double integrateWeighted(const std::vector<double> &values, const QuadratureWeights &weights, bool squared) {
+    const size_t nz = weights.nz;
+    const size_t rows = weights.rowWeights.size();
+    if (values.size() != rows * nz)
+        throw std::runtime_error("Quadrature weights do not match the grid size.");
+    const double *wz = weights.axis[2].data();
+    std::vector<double> rowSums(rows, 0.0);
+    const size_t rowsPerTask = std::max<size_t>(1, reductionBlock / nz);
+    parallelFor((rows + rowsPerTask - 1) / rowsPerTask, [&](size_t t) {
+        const size_t end = std::min(rows, (t + 1) * rowsPerTask);
+        for (size_t r = t * rowsPerTask; r < end; ++r) {
+            const double *v = values.data() + r * nz;
+            double s = 0.0;
+            if (squared)
+                for (size_t z = 0; z < nz; ++z)
+                    s += wz[z] * v[z] * v[z];
+            else
+                for (size_t z = 0; z < nz; ++z)
+                    s += wz[z] * v[z];
+            rowSums[r] = weights.rowWeights[r] * s;
+        }
+    });
+    double total = 0.0;
+    for (double s : rowSums)
+        total += s;
+    return total;
+}
+
+namespace {
+
+// A selected grid point in mass order: key is the threshold magnitude (|v|).
+struct WeightedPoint {
+    double key;
+    double value;
+    double mass;
+};
+
+} // namespace
+
+double computeIsovalueFromPercentage_Weighted(const std::vector<double> &values, const QuadratureWeights &weights,
+                                              double percent, bool orbital, bool positive, bool interpolate) {
+    std::vector<WeightedPoint> points;
+    for (size_t i = 0; i < values.size(); ++i) {
+        double v = values[i];
+        if (!orbital && !(positive ? v > 0 : v < 0))
+            continue;
+        double a = std::abs(v);
+        points.push_back({a, v, weights.weight(i) * (orbital ? v * v : a)});
+    }
+    if (points.empty())
+        throw std::runtime_error("No grid points with the requested sign.");
+    parallelSort(points, [](const WeightedPoint &a, const WeightedPoint &b) {
+        return a.key > b.key || (a.key == b.key && (a.value > b.value || (a.value == b.value && a.mass > b.mass)));
+    });
+    auto mass = [&](size_t i) { return points[i].mass; };
+    auto sameLevel = [&](size_t i, size_t j) { return points[i].key == points[j].key; };
+    double total = blockedSum(points.size(), mass);
+    double target = (percent / 100.0) * total;
+    ThresholdCrossing c = findThresholdCrossing(points.size(), mass, sameLevel, target);
+    double value = points[c.groupBegin].value;
+    if (!interpolate || c.groupBegin == 0)
+        return value;
+    double level = interpolateLevel(points[c.groupBegin - 1].key, points[c.groupBegin].key, c, target);
+    return value < 0 ? -level : level;
+}
+
+double computePercentageFromIsovalue_Weighted(const std::vector<double> &values, const QuadratureWeights &weights,
+                                              double isovalue, bool orbital, bool positive, bool interpolate) {
+    auto selected = [&](size_t i) { return orbital || (positive ? values[i] > 0 : values[i] < 0); };
+    auto mass = [&](size_t i) {
+        double v = values[i];
+        return weights.weight(i) * (orbital ? v * v : std::abs(v));
+    };
+    auto magnitude = [&](size_t i) { return std::abs(values[i]); };
+    const double a = std::abs(isovalue);
+    double total = blockedSum(values.size(), [&](size_t i) { return selected(i) ? mass(i) : 0.0; });
+    double integ = interpolate
+        ? interpolatedEnclosedMass(values.size(), magnitude, mass, selected, a)
+        : blockedSum(values.size(), [&](size_t i) { return selected(i) && magnitude(i) >= a ? mass(i) : 0.0; });
+    if (total == 0.0)
+        throw std::runtime_error("Total weighted quantity for the requested sign is zero.");
+    return (integ / total) * 100.0;
+}
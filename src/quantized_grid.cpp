@@ -0,0 +1,177 @@
+/*
+ * CubeIsoFinder
+ * File: quantized_grid.cpp
+ *
+ * Description:
+ *   Implements 16-bit logarithmic quantization of grid values and integration
+ *   functions with on-the-fly dequantization.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "quantized_grid.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const uint16_t kSignBit = 0x8000;
+const uint16_t kMagnitudeMask = 0x7fff;
+const int kLevels = 32767; // Magnitude indices 1..32767; 0 encodes zero.
+const size_t kBlock = 1 << 16;
+
+// Count how often each code occurs.
+std::vector<size_t> codeHistogram(const QuantizedGrid &grid) {
+    std::vector<size_t> counts(1 << 16, 0);
+    for (uint16_t c : grid.codes)
+        ++counts[c];
+    return counts;
+}
+
+} // namespace
+
+QuantizedGrid quantizeGrid(const std::vector<double> &values, double relativeError) {
+    if (!(relativeError > 0.0))
+        throw std::runtime_error("Quantization error bound must be positive.");
+    QuantizedGrid grid;
+    grid.relativeError = relativeError;
+    // Rounding to the nearest level in log space keeps the ratio within exp(logStep / 2).
+    grid.logStep = 2.0 * std::log1p(relativeError);
+    double maxAbs = 0.0;
+    for (double v : values)
+        maxAbs = std::max(maxAbs, std::abs(v));
+    grid.logMin = maxAbs > 0.0 ? std::log(maxAbs) - (kLevels - 1) * grid.logStep : 0.0;
+
+    grid.codes.resize(values.size());
+    const size_t blocks = (values.size() + kBlock - 1) / kBlock;
+    parallelFor(blocks, [&](size_t b) {
+        size_t end = std::min(values.size(), (b + 1) * kBlock);
+        for (size_t i = b * kBlock; i < end; ++i) {
+            double v = values[i];
+            uint16_t code = 0;
+            if (v != 0.0 && maxAbs > 0.0) {
+                double level = std::round((std::log(std::abs(v)) - grid.logMin) / grid.logStep);
+                if (level >= 0.0) {
+                    code = static_cast<uint16_t>(std::min<double>(level, kLevels - 1) + 1);
+                    if (v < 0.0)
+                        code |= kSignBit;
+                }
+            }
+            grid.codes[i] = code;
+        }
+    });
+    return grid;
+}
+
+std::vector<double> buildDequantizationTable(const QuantizedGrid &grid) {
+    std::vector<double> table(1 << 16, 0.0);
+    for (int m = 1; m <= kLevels; ++m) {
+        double mag = std::exp(grid.logMin + (m - 1) * grid.logStep);
+        table[m] = mag;
+        table[m | kSignBit] = -mag;
+    }
+    return table;
+}
+
+std::vector<double> dequantizeGrid(const QuantizedGrid &grid) {
+    const std::vector<double> table = buildDequantizationTable(grid);
+    std::vector<double> values(grid.codes.size());
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = table[grid.codes[i]];
+    return values;
+}
+
+// ----- Integration on Quantized Grids -----
+
+double computeIsovalueFromPercentage_Density(const QuantizedGrid &grid, double percent, bool positive) {
+    const std::vector<double> table = buildDequantizationTable(grid);
+    const std::vector<size_t> counts = codeHistogram(grid);
+    const uint16_t sign = positive ? 0 : kSignBit;
+    double total = 0.0;
+    size_t points = 0;
+    for (int m = 1; m <= kLevels; ++m) {
+        total += counts[m | sign] * table[m | sign];
+        points += counts[m | sign];
+    }
+    if (points == 0)
+        throw std::runtime_error("No grid points with the requested sign.");
+    double target = (percent / 100.0) * total;
+    // Walk the magnitude levels from the largest down, as the sorted search would.
+    double integ = 0.0;
+    int last = 1;
+    for (int m = kLevels; m >= 1; --m) {
+        size_t n = counts[m | sign];
+        if (n == 0)
+            continue;
+        integ += n * table[m | sign];
+        last = m;
+        if ((positive && integ >= target) || (!positive && integ <= target))
+            return table[m | sign];
+    }
+    return table[last | sign];
+}
+
+double computePercentageFromIsovalue_Density(const QuantizedGrid &grid, double isovalue, bool positive) {
+    const std::vector<double> table = buildDequantizationTable(grid);
+    double total = 0.0, integ = 0.0;
+    for (uint16_t c : grid.codes) {
+        double v = table[c];
+        if (positive && v > 0) {
+            total += v;
+            if (v >= isovalue)
+                integ += v;
+        }
+        else if (!positive && v < 0) {
+            total += v;
+            if (v <= isovalue)
+                integ += v;
+        }
+    }
+    if (total == 0.0)
+        throw std::runtime_error("Total charge for the requested sign is zero.");
+    return (integ / total) * 100.0;
+}
+
+double computeIsovalueFromPercentage_Orbital(const QuantizedGrid &grid, double percent, bool /*positive*/) {
+    if (grid.codes.empty())
+        throw std::runtime_error("No orbital grid points available.");
+    const std::vector<double> table = buildDequantizationTable(grid);
+    const std::vector<size_t> counts = codeHistogram(grid);
+    double total = 0.0;
+    for (int m = 1; m <= kLevels; ++m)
+        total += (counts[m] + counts[m | kSignBit]) * table[m] * table[m];
+    double target = (percent / 100.0) * total;
+    double integ = 0.0;
+    for (int m = kLevels; m >= 1; --m) {
+        size_t n = counts[m] + counts[m | kSignBit];
+        if (n == 0)
+            continue;
+        integ += n * table[m] * table[m];
+        if (integ >= target)
+            return counts[m] > 0 ? table[m] : table[m | kSignBit];
+    }
+    return 0.0;
+}
+
+double computePercentageFromIsovalue_Orbital(const QuantizedGrid &grid, double isovalue, bool /*positive*/) {
+    const std::vector<double> table = buildDequantizationTable(grid);
+    double thresholdDensity = isovalue * isovalue;
+    double total = 0.0, integ = 0.0;
+    for (uint16_t c : grid.codes) {
+        double v = table[c];
+        double d = v * v;
+        total += d;
+        if (d >= thresholdDensity)
+            integ += d;
+    }
+    if (total == 0.0)
+        throw std::runtime_error("Total orbital density for the requested sign is zero.");
+    return (integ / total) * 100.0;
+}
@@ -0,0 +1,159 @@
+/*
+ * CubeIsoFinder
+ * File: region_mask.cpp
+ *
+ * Description:
+ *   Implements the region masks and their application to the grid.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "region_mask.hpp"
+#include "comparison.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "spatial_analysis.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+size_t gridPoints(const CubeHeader &header) {
+    return static_cast<size_t>(header.dims[0]) * static_cast<size_t>(header.dims[1]) *
+           static_cast<size_t>(header.dims[2]);
+}
+
+size_t countInside(const std::vector<uint8_t> &inside) {
+    return static_cast<size_t>(std::count(inside.begin(), inside.end(), 1));
+}
+
+} // namespace
+
+RegionMask readRegionMaskFile(const std::string &filename, const CubeHeader &header) {
+    MappedFile file(filename);
+    const size_t n = gridPoints(header);
+    if (file.size() != (n + 7) / 8)
+        throw std::runtime_error("Error: The mask " + filename + " has " + std::to_string(file.size()) +
+                                 " bytes; a grid of " + std::to_string(n) + " points needs " +
+                                 std::to_string((n + 7) / 8) + ".");
+    RegionMask mask;
+    mask.inside.resize(n);
+    const unsigned char *bits = reinterpret_cast<const unsigned char *>(file.data());
+    parallelFor((n + reductionBlock - 1) / reductionBlock, [&](size_t block) {
+        const size_t end = std::min(n, (block + 1) * reductionBlock);
+        for (size_t i = block * reductionBlock; i < end; ++i)
+            mask.inside[i] = (bits[i >> 3] >> (i & 7)) & 1;
+    });
+    mask.count = countInside(mask.inside);
+    return mask;
+}
+
+void writeRegionMaskFile(const RegionMask &mask, const std::string &filename) {
+    std::vector<char> bits((mask.inside.size() + 7) / 8, 0);
+    for (size_t i = 0; i < mask.inside.size(); ++i)
+        bits[i >> 3] = static_cast<char>(bits[i >> 3] | (mask.inside[i] << (i & 7)));
+    std::ofstream out(filename, std::ios::binary);
+    out.write(bits.data(), static_cast<std::streamsize>(bits.size()));
+    if (!out)
+        throw std::runtime_error("Error: Cannot write mask file " + filename + ".");
+}
+
+RegionMask regionMaskFromCube(const CubeData &maskCube, const CubeHeader &header, double threshold) {
+    if (!sameGrid(maskCube.header, header))
+        throw std::runtime_error("Error: The mask cube is not on the grid of the analysed cube.");
+    const size_t n = gridPoints(header);
+    if (maskCube.values.size() != n)
+        throw std::runtime_error("Error: The mask cube holds " + std::to_string(maskCube.values.size()) +
+                                 " values; the grid has " + std::to_string(n) + ".");
+    const bool orbital = maskCube.header.isOrbital;
+    RegionMask mask;
+    mask.inside.resize(n);
+    parallelFor((n + reductionBlock - 1) / reductionBlock, [&](size_t block) {
+        const size_t end = std::min(n, (block + 1) * reductionBlock);
+        for (size_t i = block * reductionBlock; i < end; ++i) {
+            const double v = maskCube.values[i];
+            mask.inside[i] = (orbital ? std::abs(v) : v) >= threshold;
+        }
+    });
+    mask.count = countInside(mask.inside);
+    return mask;
+}
+
+RegionMask regionMaskFromAtoms(const CubeHeader &header, const std::string &spec, double radius) {
+    if (radius <= 0.0)
+        throw std::runtime_error("The mask radius must be positive.");
+    std::vector<size_t> atoms;
+    if (spec == "all") {
+        for (size_t a = 0; a < header.atoms.size(); ++a)
+            atoms.push_back(a);
+    }
+    else {
+        std::istringstream in(spec);
+        std::string field;
+        while (std::getline(in, field, ',')) {
+            size_t a = 0;
+            try {
+                a = std::stoul(field);
+            }
+            catch (const std::logic_error &) {
+                throw std::runtime_error("Atom index must be a number, got '" + field + "'.");
+            }
+            if (a < 1 || a > header.atoms.size())
+                throw std::runtime_error("Atom index out of range: " + field);
+            atoms.push_back(a - 1);
+        }
+    }
+    if (atoms.empty())
+        throw std::runtime_error("The mask selects no atoms.");
+
+    // Each task marks one x-plane; a point is inside if it is within radius of any atom.
+    const GridCoordinates coords = buildGridCoordinates(header);
+    const size_t ny = header.dims[1], nz = header.dims[2];
+    const double r2max = radius * radius;
+    RegionMask mask;
+    mask.inside.resize(gridPoints(header));
+    parallelFor(static_cast<size_t>(header.dims[0]), [&](size_t x) {
+        for (size_t y = 0; y < ny; ++y)
+            for (size_t z = 0; z < nz; ++z) {
+                double p[3];
+                for (int c = 0; c < 3; ++c)
+                    p[c] = coords.axis[0][3 * x + c] + coords.axis[1][3 * y + c] + coords.axis[2][3 * z + c];
+                uint8_t in = 0;
+                for (size_t a : atoms) {
+                    const double *q = header.atoms[a].position;
+                    const double d0 = p[0] - q[0], d1 = p[1] - q[1], d2 = p[2] - q[2];
+                    in |= d0 * d0 + d1 * d1 + d2 * d2 <= r2max;
+                }
+                mask.inside[(x * ny + y) * nz + z] = in;
+            }
+    });
+    mask.count = countInside(mask.inside);
+    return mask;
+}
+
+void intersectRegionMasks(RegionMask &mask, const RegionMask &other) {
+    if (mask.inside.size() != other.inside.size())
+        throw std::runtime_error("Region masks of different sizes cannot be combined.");
+    for (size_t i = 0; i < mask.inside.size(); ++i)
+        mask.inside[i] &= other.inside[i];
+    mask.count = countInside(mask.inside);
+}
+
+void applyRegionMask(std::vector<double> &values, const RegionMask &mask) {
+    // A truncated grid is masked over its valid prefix.
+    const size_t n = std::min(values.size(), mask.inside.size());
+    double *v = values.data();
+    const uint8_t *in = mask.inside.data();
+    parallelFor((n + reductionBlock - 1) / reductionBlock, [&](size_t block) {
+        const size_t end = std::min(n, (block + 1) * reductionBlock);
+        for (size_t i = block * reductionBlock; i < end; ++i)
+            v[i] = in[i] ? v[i] : 0.0;
+    });
+}
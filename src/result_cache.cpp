@@ -0,0 +1,189 @@
+/*
+ * CubeIsoFinder
+ * File: result_cache.cpp
+ *
+ * Description:
+ *   Implements the XXH64 content hash and the on-disk result cache.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "result_cache.hpp"
+#include "mapped_file.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#ifndef CUBEISOFINDER_VERSION
+#define CUBEISOFINDER_VERSION "unknown"
+#endif
+
+namespace {
+
+const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t prime3 = 0x165667B19E3779F9ULL;
+const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// Little-endian loads; memcpy compiles to a single move.
+inline uint64_t read64(const char *p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint32_t read32(const char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t xxRound(uint64_t acc, uint64_t input) {
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+inline uint64_t xxMergeRound(uint64_t acc, uint64_t val) {
+    acc ^= xxRound(0, val);
+    return acc * prime1 + prime4;
+}
+
+// The file name appears only in the first line of an analysis ("Processing file: <name>",
+// possibly followed by more text). Only that occurrence is substituted, so names that
+// also occur in numbers or other text (e.g. a file called "1") leave the rest untouched.
+std::string replaceFileName(std::string text, const std::string &from, const std::string &to) {
+    const size_t lineEnd = text.find('\n');
+    const size_t colon = text.find(": ");
+    if (from.empty() || colon == std::string::npos || colon > lineEnd)
+        return text;
+    const size_t pos = colon + 2;
+    const size_t end = pos + from.size();
+    if (text.compare(pos, from.size(), from) == 0 && (end == text.size() || text[end] == '\n' || text[end] == ' '))
+        text.replace(pos, from.size(), to);
+    return text;
+}
+
+} // namespace
+
+uint64_t hashBytes(const char *data, size_t size, uint64_t seed) {
+    const char *p = data;
+    const char *end = data + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        const char *limit = end - 32;
+        do {
+            for (int lane = 0; lane < 4; ++lane)
+                v[lane] = xxRound(v[lane], read64(p + 8 * lane));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int lane = 0; lane < 4; ++lane)
+            h = xxMergeRound(h, v[lane]);
+    }
+    else {
+        h = seed + prime5;
+    }
+    h += static_cast<uint64_t>(size);
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ xxRound(0, read64(p)), 27) * prime1 + prime4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (static_cast<uint64_t>(read32(p)) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl(h ^ (static_cast<uint64_t>(static_cast<unsigned char>(*p)) * prime5), 11) * prime1;
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hashFile(const std::string &filename) {
+    MappedFile file(filename);
+    return hashBytes(file.data(), file.size());
+}
+
+std::string defaultCacheDirectory() {
+    if (const char *dir = std::getenv("CUBEISOFINDER_CACHE"))
+        return dir;
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"))
+        return std::string(xdg) + "/cubeisofinder";
+    if (const char *home = std::getenv("HOME"))
+        return std::string(home) + "/.cache/cubeisofinder";
+    return ".cubeisofinder-cache";
+}
+
+std::string resultCacheKey(uint64_t contentHash, const std::string &query) {
+    std::string description = query + ";version=" CUBEISOFINDER_VERSION;
+    char key[40];
+    std::snprintf(key, sizeof(key), "%016llx-%016llx", static_cast<unsigned long long>(contentHash),
+                  static_cast<unsigned long long>(hashBytes(description.data(), description.size())));
+    return key;
+}
+
+bool loadCachedResult(const std::string &directory, const std::string &key, const std::string &filename,
+                      std::string &output) {
+    std::ifstream in(directory + "/" + key + ".txt", std::ios::binary);
+    if (!in)
+        return false;
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    output = replaceFileName(contents.str(), fileNamePlaceholder, filename);
+    return true;
+}
+
+void storeCachedResult(const std::string &directory, const std::string &key, const std::string &output) {
+    // A cache that cannot be written is not an error; the result is just not stored.
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    const std::string path = directory + "/" + key + ".txt";
+    const std::string temporary = path + ".tmp" + std::to_string(std::random_device()());
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out)
+            return;
+        out.write(output.data(), static_cast<std::streamsize>(output.size()));
+        if (!out)
+            return;
+    }
+    std::filesystem::rename(temporary, path, ec);
+    if (ec)
+        std::filesystem::remove(temporary, ec);
+}
+
+ResultRecorder::ResultRecorder(std::string directory, std::string key, std::string filename)
+    : directory_(std::move(directory)), key_(std::move(key)), filename_(std::move(filename)), tee_(std::cout.rdbuf(), output_),
+      original_(std::cout.rdbuf(&tee_)) {}
+
+ResultRecorder::~ResultRecorder() {
+    std::cout.flush();
+    std::cout.rdbuf(original_);
+    if (!discarded_)
+        storeCachedResult(directory_, key_, replaceFileName(output_, filename_, fileNamePlaceholder));
+}
+
+int ResultRecorder::TeeBuffer::overflow(int c) {
+    if (c == traits_type::eof())
+        return traits_type::not_eof(c);
+    copy_.push_back(static_cast<char>(c));
+    return target_->sputc(static_cast<char>(c));
+}
+
+std::streamsize ResultRecorder::TeeBuffer::xsputn(const char *s, std::streamsize n) {
+    copy_.append(s, static_cast<size_t>(n));
+    return target_->sputn(s, n);
+}
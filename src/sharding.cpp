@@ -0,0 +1,245 @@
+/*
+ * CubeIsoFinder
+ * File: sharding.cpp
+ *
+ * Description:
+ *   Implements manifests, shard processing and the merge of partial result files.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "sharding.hpp"
+#include "cube_parser.hpp"
+#include "parallel.hpp"
+#include "result_cache.hpp"
+#include "volumetric_formats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+const char *const partialMagic = "# CubeIsoFinder shard partial v1";
+
+// Tabs and line breaks separate fields and entries in a partial file.
+std::string sanitize(std::string text) {
+    std::replace_if(text.begin(), text.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+    return text;
+}
+
+std::vector<std::string> splitTabs(const std::string &line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (size_t pos = line.find('\t'); pos != std::string::npos; pos = line.find('\t', start)) {
+        fields.push_back(line.substr(start, pos - start));
+        start = pos + 1;
+    }
+    fields.push_back(line.substr(start));
+    return fields;
+}
+
+ShardEntry analyseEntry(size_t index, const std::string &file, const ShardQuery &query) {
+    ShardEntry e{index, file, false, "", false, 0.0, 0.0, 0.0};
+    try {
+        CubeData cube = loadCube(file, query.allowTruncated);
+        const bool orbital = cube.header.isOrbital;
+        e.isOrbital = orbital;
+        e.total = blockedSum(cube.values.size(), [&](size_t k) {
+                      double v = cube.values[k];
+                      return orbital ? v * v : v;
+                  }) *
+                  computeVoxelVolume(cube.header);
+        if (query.usePercentage)
+            e.isovalue = orbital ? computeIsovalueFromPercentage_Orbital(cube.values, query.inputValue, query.positive,
+                                                                         query.interpolate)
+                                 : computeIsovalueFromPercentage_Density(cube.values, query.inputValue, query.positive,
+                                                                         query.interpolate);
+        else
+            e.isovalue = query.inputValue;
+        e.percentage = orbital ? computePercentageFromIsovalue_Orbital(cube.values, e.isovalue, query.positive,
+                                                                       query.interpolate)
+                               : computePercentageFromIsovalue_Density(cube.values, e.isovalue, query.positive,
+                                                                       query.interpolate);
+        e.ok = true;
+    }
+    catch (const std::exception &ex) {
+        e.message = sanitize(ex.what());
+    }
+    return e;
+}
+
+} // namespace
+
+Manifest readManifest(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in)
+        throw std::runtime_error("Unable to open manifest: " + filename);
+    const std::filesystem::path base = std::filesystem::path(filename).parent_path();
+    Manifest manifest;
+    manifest.contentHash = hashFile(filename);
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::filesystem::path path(line);
+        manifest.files.push_back(path.is_absolute() || base.empty() ? line : (base / path).string());
+    }
+    if (manifest.files.empty())
+        throw std::runtime_error("The manifest " + filename + " lists no files.");
+    return manifest;
+}
+
+std::string describeShardQuery(const ShardQuery &query) {
+    std::ostringstream out;
+    out << std::setprecision(17) << (query.usePercentage ? "p=" : "v=") << query.inputValue
+        << ";positive=" << query.positive << ";interpolate=" << query.interpolate
+        << ";allowTruncated=" << query.allowTruncated;
+    return out.str();
+}
+
+void parseShardSpec(const std::string &spec, size_t &shard, size_t &shardCount) {
+    size_t slash = spec.find('/');
+    try {
+        if (slash == std::string::npos)
+            throw std::invalid_argument(spec);
+        shard = std::stoul(spec.substr(0, slash));
+        shardCount = std::stoul(spec.substr(slash + 1));
+    }
+    catch (const std::exception &) {
+        throw std::runtime_error("Shard must be given as i/N, got " + spec + ".");
+    }
+    if (shardCount == 0 || shard >= shardCount)
+        throw std::runtime_error("Shard index must satisfy 0 <= i < N, got " + spec + ".");
+}
+
+ShardPartial runShard(const Manifest &manifest, size_t shard, size_t shardCount, const ShardQuery &query) {
+    ShardPartial partial{manifest.contentHash, manifest.files.size(), shard, shardCount, describeShardQuery(query), {}};
+    // Each cube is analysed with all worker threads; cubes are processed one after another.
+    for (size_t i = shard; i < manifest.files.size(); i += shardCount)
+        partial.entries.push_back(analyseEntry(i, manifest.files[i], query));
+    return partial;
+}
+
+void writeShardPartial(const ShardPartial &partial, const std::string &filename) {
+    std::ostringstream out;
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(partial.manifestHash));
+    out << partialMagic << "\n"
+        << "manifest\t" << hash << "\t" << partial.manifestEntries << "\n"
+        << "shard\t" << partial.shard << "\t" << partial.shardCount << "\n"
+        << "query\t" << partial.query << "\n"
+        << std::setprecision(17);
+    for (const ShardEntry &e : partial.entries)
+        out << "entry\t" << e.index << "\t" << (e.ok ? "ok" : "error") << "\t" << (e.isOrbital ? "orbital" : "density")
+            << "\t" << e.total << "\t" << e.isovalue << "\t" << e.percentage << "\t" << sanitize(e.file) << "\t"
+            << e.message << "\n";
+    out << "end\t" << partial.entries.size() << "\n";
+
+    // Written to a temporary file and renamed, so a partial is either complete or absent.
+    const std::string temporary = filename + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        const std::string text = out.str();
+        file.write(text.data(), static_cast<std::streamsize>(text.size()));
+        if (!file)
+            throw std::runtime_error("Unable to write partial result file: " + filename);
+    }
+    std::filesystem::rename(temporary, filename);
+}
+
+ShardPartial readShardPartial(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in)
+        throw std::runtime_error("Unable to open partial result file: " + filename);
+    auto fail = [&](const std::string &what) {
+        throw std::runtime_error("Malformed partial result file " + filename + ": " + what);
+    };
+    std::string line;
+    if (!std::getline(in, line) || line != partialMagic)
+        fail("missing header");
+
+    ShardPartial partial{0, 0, 0, 0, "", {}};
+    bool complete = false;
+    while (std::getline(in, line)) {
+        std::vector<std::string> f = splitTabs(line);
+        try {
+            if (f[0] == "manifest" && f.size() == 3) {
+                partial.manifestHash = std::stoull(f[1], nullptr, 16);
+                partial.manifestEntries = std::stoul(f[2]);
+            }
+            else if (f[0] == "shard" && f.size() == 3) {
+                partial.shard = std::stoul(f[1]);
+                partial.shardCount = std::stoul(f[2]);
+            }
+            else if (f[0] == "query" && f.size() == 2) {
+                partial.query = f[1];
+            }
+            else if (f[0] == "entry" && f.size() == 9) {
+                partial.entries.push_back({std::stoul(f[1]), f[7], f[2] == "ok", f[8], f[3] == "orbital",
+                                           std::stod(f[4]), std::stod(f[5]), std::stod(f[6])});
+            }
+            else if (f[0] == "end" && f.size() == 2) {
+                if (std::stoul(f[1]) != partial.entries.size())
+                    fail("entry count mismatch");
+                complete = true;
+            }
+            else {
+                fail("unexpected line '" + line + "'");
+            }
+        }
+        catch (const std::logic_error &) {
+            fail("bad number in line '" + line + "'");
+        }
+    }
+    if (!complete)
+        fail("missing end marker");
+    if (partial.shardCount == 0 || partial.shard >= partial.shardCount)
+        fail("bad shard line");
+    return partial;
+}
+
+std::vector<ShardEntry> mergeShardPartials(const std::vector<ShardPartial> &partials) {
+    if (partials.empty())
+        throw std::runtime_error("No partial result files to merge.");
+    const ShardPartial &first = partials[0];
+    std::vector<bool> shardSeen(first.shardCount, false);
+    std::vector<ShardEntry> merged(first.manifestEntries);
+    std::vector<bool> entrySeen(first.manifestEntries, false);
+    for (const ShardPartial &p : partials) {
+        if (p.manifestHash != first.manifestHash || p.manifestEntries != first.manifestEntries)
+            throw std::runtime_error("Partial results come from different manifests.");
+        if (p.query != first.query)
+            throw std::runtime_error("Partial results come from different queries (" + p.query + " vs " +
+                                     first.query + ").");
+        if (p.shardCount != first.shardCount)
+            throw std::runtime_error("Partial results use different shard counts.");
+        if (shardSeen[p.shard])
+            throw std::runtime_error("Shard " + std::to_string(p.shard) + " is given more than once.");
+        shardSeen[p.shard] = true;
+        for (const ShardEntry &e : p.entries) {
+            if (e.index >= merged.size() || e.index % p.shardCount != p.shard || entrySeen[e.index])
+                throw std::runtime_error("Shard " + std::to_string(p.shard) + " holds an unexpected entry " +
+                                         std::to_string(e.index) + ".");
+            entrySeen[e.index] = true;
+            merged[e.index] = e;
+        }
+    }
+    for (size_t s = 0; s < shardSeen.size(); ++s)
+        if (!shardSeen[s])
+            throw std::runtime_error("Shard " + std::to_string(s) + "/" + std::to_string(first.shardCount) +
+                                     " is missing.");
+    for (size_t i = 0; i < entrySeen.size(); ++i)
+        if (!entrySeen[i])
+            throw std::runtime_error("Manifest entry " + std::to_string(i) + " is missing from shard " +
+                                     std::to_string(i % first.shardCount) + ".");
+    return merged;
+}
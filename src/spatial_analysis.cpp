@@ -0,0 +1,186 @@
+/*
+ * CubeIsoFinder
+ * File: spatial_analysis.cpp
+ *
+ * Description:
+ *   Implements grid coordinate tables, radial profiles and region moments.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "spatial_analysis.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+GridCoordinates buildGridCoordinates(const CubeHeader &header) {
+    GridCoordinates coords;
+    for (int a = 0; a < 3; ++a) {
+        coords.axis[a].resize(3 * static_cast<size_t>(header.dims[a]));
+        for (int i = 0; i < header.dims[a]; ++i)
+            for (int c = 0; c < 3; ++c)
+                coords.axis[a][3 * i + c] = i * header.axisVectors[a][c + 1] + (a == 0 ? header.origin[c] : 0.0);
+    }
+    return coords;
+}
+
+RadialProfile computeRadialProfile(const CubeData &cube, const GridCoordinates &coords, const double center[3],
+                                   double binWidth) {
+    if (binWidth <= 0.0)
+        throw std::runtime_error("Radial bin width must be positive.");
+    const int *dims = cube.header.dims;
+    const bool squared = cube.header.isOrbital;
+    RadialProfile profile;
+    std::copy(center, center + 3, profile.center);
+    profile.binWidth = binWidth;
+
+    // The farthest grid point from the centre is one of the eight corners.
+    double maxRadius = 0.0;
+    for (int corner = 0; corner < 8; ++corner) {
+        double r2 = 0.0;
+        for (int c = 0; c < 3; ++c) {
+            double p = -center[c];
+            for (int a = 0; a < 3; ++a)
+                p += coords.axis[a][3 * static_cast<size_t>((corner >> a) & 1 ? dims[a] - 1 : 0) + c];
+            r2 += p * p;
+        }
+        maxRadius = std::max(maxRadius, std::sqrt(r2));
+    }
+    const size_t bins = static_cast<size_t>(maxRadius / binWidth) + 1;
+    const double inverseWidth = 1.0 / binWidth;
+
+    // Each task bins one x-plane into its own histogram; the plane histograms are added in
+    // plane order, so the result is independent of the number of threads.
+    const size_t n = cube.values.size();
+    std::vector<std::vector<double>> planes(static_cast<size_t>(dims[0]));
+    parallelFor(planes.size(), [&](size_t x) {
+        std::vector<double> &hist = planes[x];
+        hist.assign(bins, 0.0);
+        const double *px = &coords.axis[0][3 * x];
+        for (int y = 0; y < dims[1]; ++y) {
+            const double *py = &coords.axis[1][3 * static_cast<size_t>(y)];
+            const double rx = px[0] + py[0] - center[0];
+            const double ry = px[1] + py[1] - center[1];
+            const double rz = px[2] + py[2] - center[2];
+            const size_t row = (x * dims[1] + y) * static_cast<size_t>(dims[2]);
+            const int zEnd = static_cast<int>(std::min<size_t>(dims[2], n > row ? n - row : 0));
+            for (int z = 0; z < zEnd; ++z) {
+                const double *pz = &coords.axis[2][3 * static_cast<size_t>(z)];
+                const double dx = rx + pz[0], dy = ry + pz[1], dz = rz + pz[2];
+                const size_t b = std::min(bins - 1, static_cast<size_t>(std::sqrt(dx * dx + dy * dy + dz * dz) *
+                                                                          inverseWidth));
+                const double v = cube.values[row + z];
+                hist[b] += squared ? v * v : v;
+            }
+        }
+    });
+
+    const double voxelVolume = computeVoxelVolume(cube.header);
+    profile.shell.assign(bins, 0.0);
+    for (const auto &hist : planes)
+        for (size_t b = 0; b < bins; ++b)
+            profile.shell[b] += hist[b];
+    profile.cumulative.resize(bins);
+    double running = 0.0;
+    for (size_t b = 0; b < bins; ++b) {
+        profile.shell[b] *= voxelVolume;
+        running += profile.shell[b];
+        profile.cumulative[b] = running;
+    }
+    profile.total = running;
+    return profile;
+}
+
+double radiusEnclosingPercentage(const RadialProfile &profile, double percent) {
+    const double target = profile.total * percent / 100.0;
+    for (size_t b = 0; b < profile.cumulative.size(); ++b) {
+        if (profile.cumulative[b] >= target) {
+            double before = profile.cumulative[b] - profile.shell[b];
+            double fraction = profile.shell[b] > 0.0 ? (target - before) / profile.shell[b] : 0.0;
+            return (b + std::clamp(fraction, 0.0, 1.0)) * profile.binWidth;
+        }
+    }
+    return profile.cumulative.size() * profile.binWidth;
+}
+
+RegionMoments computeRegionMoments(const CubeData &cube, const GridCoordinates &coords, double isovalue,
+                                   bool positive) {
+    const int *dims = cube.header.dims;
+    const bool orbital = cube.header.isOrbital;
+    const double threshold = isovalue * isovalue;
+    // Positions are taken relative to the grid centre so that the second moments do not
+    // suffer from cancellation for grids far from the coordinate origin.
+    double reference[3];
+    for (int c = 0; c < 3; ++c) {
+        reference[c] = 0.0;
+        for (int a = 0; a < 3; ++a)
+            reference[c] += coords.axis[a][3 * static_cast<size_t>((dims[a] - 1) / 2) + c];
+    }
+
+    // Per plane: count, sum w, sum w r (3), sum w r r^T (6 unique entries).
+    enum { Count, Mass, X, Y, Z, XX, XY, XZ, YY, YZ, ZZ, Terms };
+    const size_t n = cube.values.size();
+    std::vector<std::array<double, Terms>> planes(static_cast<size_t>(dims[0]));
+    parallelFor(planes.size(), [&](size_t x) {
+        std::array<double, Terms> acc{};
+        const double *px = &coords.axis[0][3 * x];
+        for (int y = 0; y < dims[1]; ++y) {
+            const double *py = &coords.axis[1][3 * static_cast<size_t>(y)];
+            const double rx = px[0] + py[0] - reference[0];
+            const double ry = px[1] + py[1] - reference[1];
+            const double rz = px[2] + py[2] - reference[2];
+            const size_t row = (x * dims[1] + y) * static_cast<size_t>(dims[2]);
+            const int zEnd = static_cast<int>(std::min<size_t>(dims[2], n > row ? n - row : 0));
+            for (int z = 0; z < zEnd; ++z) {
+                const double v = cube.values[row + z];
+                const bool inside = orbital ? v * v >= threshold : (positive ? v >= isovalue : v <= isovalue);
+                if (!inside)
+                    continue;
+                const double *pz = &coords.axis[2][3 * static_cast<size_t>(z)];
+                const double dx = rx + pz[0], dy = ry + pz[1], dz = rz + pz[2];
+                const double w = orbital ? v * v : v;
+                acc[Count] += 1.0;
+                acc[Mass] += w;
+                acc[X] += w * dx;
+                acc[Y] += w * dy;
+                acc[Z] += w * dz;
+                acc[XX] += w * dx * dx;
+                acc[XY] += w * dx * dy;
+                acc[XZ] += w * dx * dz;
+                acc[YY] += w * dy * dy;
+                acc[YZ] += w * dy * dz;
+                acc[ZZ] += w * dz * dz;
+            }
+        }
+        planes[x] = acc;
+    });
+
+    std::array<double, Terms> sum{};
+    for (const auto &acc : planes)
+        for (int t = 0; t < Terms; ++t)
+            sum[t] += acc[t];
+
+    const double voxelVolume = computeVoxelVolume(cube.header);
+    RegionMoments m{};
+    m.points = static_cast<size_t>(sum[Count]);
+    m.mass = sum[Mass] * voxelVolume;
+    if (sum[Mass] == 0.0)
+        return m;
+    const double mean[3] = {sum[X] / sum[Mass], sum[Y] / sum[Mass], sum[Z] / sum[Mass]};
+    const int second[3][3] = {{XX, XY, XZ}, {XY, YY, YZ}, {XZ, YZ, ZZ}};
+    for (int i = 0; i < 3; ++i) {
+        m.centroid[i] = mean[i] + reference[i];
+        m.firstMoment[i] = m.mass * m.centroid[i];
+        for (int j = 0; j < 3; ++j)
+            m.secondMoments[i][j] = sum[second[i][j]] / sum[Mass] - mean[i] * mean[j];
+    }
+    m.radiusOfGyration = std::sqrt(std::max(0.0, m.secondMoments[0][0] + m.secondMoments[1][1] +
+                                                     m.secondMoments[2][2]));
+    return m;
+}
@@ -0,0 +1,176 @@
+/*
+ * CubeIsoFinder
+ * File: streaming.cpp
+ *
+ * Description:
+ *   Implements the parse/analysis pipeline and the streaming isovalue-to-percentage
+ *   computation on text cube files.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "streaming.hpp"
+#include "parallel.hpp"
+#include "threshold_search.hpp"
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+CubeValueStream::CubeValueStream(const std::string &filename) : file_(filename) {
+    header_ = parseCubeHeader(file_.data(), file_.size(), dataOffset_);
+}
+
+size_t CubeValueStream::run(const BlockConsumer &consume, bool allowTruncated) {
+    const size_t totalPoints = static_cast<size_t>(header_.dims[0]) * header_.dims[1] * header_.dims[2];
+    const char *p = file_.data() + dataOffset_;
+    const char *end = file_.end();
+
+    // Ring of blocks: the producer fills slot (produced % queueSlots) and publishes it by
+    // incrementing produced; the consumer releases a slot by incrementing consumed. Each
+    // counter is written by one side only, so no lock is needed.
+    std::vector<std::vector<double>> slots(queueSlots);
+    for (auto &slot : slots)
+        slot.reserve(reductionBlock);
+    std::atomic<size_t> produced(0), consumed(0);
+    std::atomic<bool> finished(false), cancelled(false);
+    std::exception_ptr producerError;
+
+    // Decode one block into the next free slot; returns false at the end of the data.
+    auto produceBlock = [&]() {
+        std::vector<double> &slot = slots[produced.load(std::memory_order_relaxed) % queueSlots];
+        slot.clear();
+        scanValues(p, end, slot, reductionBlock);
+        if (slot.empty())
+            return false;
+        produced.fetch_add(1, std::memory_order_release);
+        return slot.size() == reductionBlock;
+    };
+    size_t count = 0;
+    auto consumeBlock = [&]() {
+        const std::vector<double> &slot = slots[consumed.load(std::memory_order_relaxed) % queueSlots];
+        consume(slot.data(), slot.size(), count);
+        count += slot.size();
+        consumed.fetch_add(1, std::memory_order_release);
+    };
+
+    if (workerCount() <= 1) {
+        while (produceBlock())
+            consumeBlock();
+        if (produced.load() > consumed.load())
+            consumeBlock();
+    }
+    else {
+        std::thread producer([&]() {
+            try {
+                while (!cancelled.load(std::memory_order_relaxed)) {
+                    // Back-pressure: wait while all slots hold unconsumed blocks.
+                    while (produced.load(std::memory_order_relaxed) - consumed.load(std::memory_order_acquire) ==
+                               queueSlots &&
+                           !cancelled.load(std::memory_order_relaxed))
+                        std::this_thread::yield();
+                    if (cancelled.load(std::memory_order_relaxed) || !produceBlock())
+                        break;
+                }
+            }
+            catch (...) {
+                producerError = std::current_exception();
+            }
+            finished.store(true, std::memory_order_release);
+        });
+        try {
+            while (true) {
+                if (consumed.load(std::memory_order_relaxed) < produced.load(std::memory_order_acquire))
+                    consumeBlock();
+                else if (finished.load(std::memory_order_acquire)) {
+                    // Blocks published before the producer finished are visible now.
+                    if (consumed.load(std::memory_order_relaxed) == produced.load(std::memory_order_acquire))
+                        break;
+                }
+                else
+                    std::this_thread::yield();
+            }
+        }
+        catch (...) {
+            cancelled.store(true);
+            producer.join();
+            throw;
+        }
+        producer.join();
+        if (producerError)
+            std::rethrow_exception(producerError);
+    }
+
+    while (p < end && std::isspace(static_cast<unsigned char>(*p)))
+        ++p;
+    if (p < end && !allowTruncated) {
+        const char *tokenEnd = p;
+        while (tokenEnd < end && !std::isspace(static_cast<unsigned char>(*tokenEnd)))
+            ++tokenEnd;
+        throw std::runtime_error("Error: Malformed value '" + std::string(p, tokenEnd) + "' at byte offset " +
+                                 std::to_string(p - file_.data()) + ".");
+    }
+    if (count != totalPoints && !(allowTruncated && count < totalPoints))
+        throw std::runtime_error("Error: Number of grid points read (" + std::to_string(count) +
+                                 ") does not match expected (" + std::to_string(totalPoints) + ").");
+    return count;
+}
+
+StreamingResult streamPercentageFromIsovalue(const std::string &filename, double isovalue, bool positive,
+                                             bool interpolate, bool allowTruncated) {
+    CubeValueStream stream(filename);
+    StreamingResult result{};
+    result.header = stream.header();
+    const bool orbital = result.header.isOrbital;
+
+    // The selection and mass of each value, as in the in-memory integration functions.
+    const double magnitudeThreshold = std::abs(isovalue);
+    auto selected = [&](double v) { return orbital || (positive ? v > 0 : v < 0); };
+    auto mass = [&](double v) { return orbital ? v * v : v; };
+    auto enclosed = [&](double v) {
+        return orbital ? v * v >= isovalue * isovalue : (positive ? v >= isovalue : v <= isovalue);
+    };
+
+    double sum = 0.0, total = 0.0, integ = 0.0;
+    EnclosedMassAccumulator interpolated;
+    result.points = stream.run(
+        [&](const double *values, size_t count, size_t) {
+            double blockSum = 0.0, blockTotal = 0.0, blockInteg = 0.0;
+            EnclosedMassAccumulator blockInterpolated;
+            for (size_t i = 0; i < count; ++i) {
+                const double v = values[i];
+                blockSum += mass(v);
+                if (!selected(v))
+                    continue;
+                blockTotal += mass(v);
+                if (interpolate)
+                    blockInterpolated.add(std::abs(v), orbital ? v * v : std::abs(v), magnitudeThreshold);
+                else if (enclosed(v))
+                    blockInteg += mass(v);
+            }
+            sum += blockSum;
+            total += blockTotal;
+            integ += blockInteg;
+            interpolated.merge(blockInterpolated);
+        },
+        allowTruncated);
+
+    if (interpolate) {
+        integ = interpolated.interpolated(magnitudeThreshold);
+        if (!orbital && !positive)
+            integ = -integ;
+    }
+    if (total == 0.0)
+        throw std::runtime_error(orbital ? "Total orbital density for the requested sign is zero."
+                                         : "Total charge for the requested sign is zero.");
+    result.sum = sum;
+    result.percentage = (integ / total) * 100.0;
+    return result;
+}
@@ -0,0 +1,342 @@
+/*
+ * CubeIsoFinder
+ * File: volumetric_formats.cpp
+ *
+ * Description:
+ *   Implements readers for VASP CHGCAR and XSF DATAGRID_3D files and the
+ *   format-detecting loader.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "volumetric_formats.hpp"
+#include "cube_binary.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+const double bohrInAngstrom = 0.529177210544;
+
+const char *const elementSymbols[] = {
+    "H",  "He", "Li", "Be", "B",  "C",  "N",  "O",  "F",  "Ne", "Na", "Mg", "Al", "Si", "P",  "S",  "Cl", "Ar",
+    "K",  "Ca", "Sc", "Ti", "V",  "Cr", "Mn", "Fe", "Co", "Ni", "Cu", "Zn", "Ga", "Ge", "As", "Se", "Br", "Kr",
+    "Rb", "Sr", "Y",  "Zr", "Nb", "Mo", "Tc", "Ru", "Rh", "Pd", "Ag", "Cd", "In", "Sn", "Sb", "Te", "I",  "Xe",
+    "Cs", "Ba", "La", "Ce", "Pr", "Nd", "Pm", "Sm", "Eu", "Gd", "Tb", "Dy", "Ho", "Er", "Tm", "Yb", "Lu", "Hf",
+    "Ta", "W",  "Re", "Os", "Ir", "Pt", "Au", "Hg", "Tl", "Pb", "Bi", "Po", "At", "Rn", "Fr", "Ra", "Ac", "Th",
+    "Pa", "U",  "Np", "Pu", "Am", "Cm", "Bk", "Cf", "Es", "Fm"};
+
+// Atomic number for an element symbol or a numeric string; 0 if unknown.
+// VASP POTCAR labels such as "Fe_pv" or "O_s" are accepted.
+int atomicNumber(const std::string &token) {
+    if (!token.empty() && std::isdigit(static_cast<unsigned char>(token[0])))
+        return std::atoi(token.c_str());
+    std::string symbol = token.substr(0, token.find_first_of("_/."));
+    for (size_t z = 0; z < sizeof(elementSymbols) / sizeof(elementSymbols[0]); ++z)
+        if (icontains(symbol, elementSymbols[z]) && symbol.size() == std::strlen(elementSymbols[z]))
+            return static_cast<int>(z + 1);
+    return 0;
+}
+
+// Line-oriented cursor over a mapped file.
+struct LineReader {
+    const char *data;
+    size_t size;
+    size_t pos;
+
+    bool atEnd() const { return pos >= size; }
+    std::string next() {
+        if (pos >= size)
+            throw std::runtime_error("Error: Unexpected end of file.");
+        const char *begin = data + pos;
+        const char *nl = static_cast<const char *>(std::memchr(begin, '\n', size - pos));
+        size_t len = nl ? static_cast<size_t>(nl - begin) : size - pos;
+        pos += nl ? len + 1 : len;
+        return trim(std::string(begin, len));
+    }
+};
+
+std::vector<std::string> tokens(const std::string &line) {
+    std::istringstream iss(line);
+    std::vector<std::string> out;
+    std::string t;
+    while (iss >> t)
+        out.push_back(t);
+    return out;
+}
+
+bool isNumber(const std::string &token) {
+    if (token.empty())
+        return false;
+    char *end = nullptr;
+    std::strtod(token.c_str(), &end);
+    return *end == '\0';
+}
+
+double cellVolume(const double a[3][3]) {
+    return std::abs(a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+                    a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+                    a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]));
+}
+
+// Read nx * ny * nz values stored x fastest and return them in x-major order (z fastest).
+std::vector<double> readFortranOrderGrid(const char *&p, const char *end, const int n[3],
+                                         const std::string &what) {
+    const size_t total = static_cast<size_t>(n[0]) * n[1] * n[2];
+    std::vector<double> raw;
+    raw.reserve(total);
+    if (scanValues(p, end, raw, total) != total)
+        throw std::runtime_error("Error: Number of " + what + " grid points read (" + std::to_string(raw.size()) +
+                                 ") does not match expected (" + std::to_string(total) + ").");
+    std::vector<double> values(total);
+    const size_t nx = n[0], ny = n[1], nz = n[2];
+    parallelFor(nx, [&](size_t x) {
+        for (size_t y = 0; y < ny; ++y)
+            for (size_t z = 0; z < nz; ++z)
+                values[(x * ny + y) * nz + z] = raw[x + nx * (y + ny * z)];
+    });
+    return values;
+}
+
+// Fill the geometric part of a header from lattice vectors (Å) spanning the grid.
+void setGridGeometry(CubeHeader &header, const double origin[3], const double span[3][3], const int dims[3],
+                     const int divisions[3]) {
+    for (int i = 0; i < 3; ++i) {
+        header.origin[i] = origin[i] / bohrInAngstrom;
+        header.dims[i] = dims[i];
+        header.axisVectors[i][0] = dims[i];
+        for (int j = 0; j < 3; ++j)
+            header.axisVectors[i][j + 1] = span[i][j] / divisions[i] / bohrInAngstrom;
+    }
+}
+
+} // namespace
+
+CubeData readChgcarFile(const std::string &filename) {
+    MappedFile file(filename);
+    LineReader in{file.data(), file.size(), 0};
+    CubeData cube;
+    CubeHeader &h = cube.header;
+    h.comment1 = in.next();
+    h.comment2 = "Converted from VASP CHGCAR, electron density";
+    h.calcType = "VASP";
+    h.isOrbital = false;
+
+    double scale = std::stod(in.next());
+    double lattice[3][3];
+    for (int i = 0; i < 3; ++i) {
+        std::istringstream iss(in.next());
+        if (!(iss >> lattice[i][0] >> lattice[i][1] >> lattice[i][2]))
+            throw std::runtime_error("Error reading lattice vector " + std::to_string(i));
+    }
+    // A negative scale factor is the cell volume.
+    if (scale < 0)
+        scale = std::cbrt(-scale / cellVolume(lattice));
+    for (auto &row : lattice)
+        for (double &x : row)
+            x *= scale;
+
+    // VASP 5 lists the element symbols before the counts; VASP 4 does not.
+    std::vector<std::string> symbols = tokens(in.next());
+    std::vector<std::string> counts = symbols;
+    if (!symbols.empty() && !isNumber(symbols[0]))
+        counts = tokens(in.next());
+    else
+        symbols.clear();
+    std::string mode = in.next();
+    if (!mode.empty() && (mode[0] == 'S' || mode[0] == 's'))
+        mode = in.next();
+    bool cartesian = !mode.empty() && (mode[0] == 'C' || mode[0] == 'c' || mode[0] == 'K' || mode[0] == 'k');
+    for (size_t s = 0; s < counts.size(); ++s) {
+        int z = s < symbols.size() ? atomicNumber(symbols[s]) : 0;
+        for (int k = 0; k < std::stoi(counts[s]); ++k) {
+            std::istringstream iss(in.next());
+            double c[3];
+            if (!(iss >> c[0] >> c[1] >> c[2]))
+                throw std::runtime_error("Error reading atom position in " + filename);
+            CubeAtom atom{z, static_cast<double>(z), {0.0, 0.0, 0.0}};
+            for (int j = 0; j < 3; ++j) {
+                double x = cartesian ? c[j] * scale
+                                     : c[0] * lattice[0][j] + c[1] * lattice[1][j] + c[2] * lattice[2][j];
+                atom.position[j] = x / bohrInAngstrom;
+            }
+            h.atoms.push_back(atom);
+        }
+    }
+    h.numAtoms = static_cast<int>(h.atoms.size());
+
+    // A blank line separates the structure from the grid dimensions.
+    std::string line;
+    do
+        line = in.next();
+    while (line.empty());
+    int n[3];
+    std::istringstream iss(line);
+    if (!(iss >> n[0] >> n[1] >> n[2]))
+        throw std::runtime_error("Error reading grid dimensions in " + filename);
+
+    const double zero[3] = {0.0, 0.0, 0.0};
+    setGridGeometry(h, zero, lattice, n, n);
+    const char *p = file.data() + in.pos;
+    cube.values = readFortranOrderGrid(p, file.end(), n, "CHGCAR");
+
+    // rho * V_cell (Å^3) -> electrons/Å^3 -> electrons/bohr^3.
+    const double factor = std::pow(bohrInAngstrom, 3.0) / cellVolume(lattice);
+    for (double &v : cube.values)
+        v *= factor;
+    return cube;
+}
+
+CubeData readXsfFile(const std::string &filename) {
+    MappedFile file(filename);
+    LineReader in{file.data(), file.size(), 0};
+    CubeData cube;
+    CubeHeader &h = cube.header;
+    h.comment2 = "Converted from XSF DATAGRID_3D, density";
+    h.calcType = "XSF";
+    h.isOrbital = false;
+    bool periodic = false;
+    bool haveGrid = false;
+
+    while (!in.atEnd() && !haveGrid) {
+        std::string line = in.next();
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::vector<std::string> t = tokens(line);
+        const std::string &key = t[0];
+        if (key == "PRIMVEC") {
+            periodic = true;
+            for (int i = 0; i < 3; ++i)
+                in.next();
+        }
+        else if (key == "PRIMCOORD" || key == "ATOMS") {
+            int count = -1;
+            if (key == "PRIMCOORD")
+                count = std::stoi(tokens(in.next()).at(0));
+            // ATOMS lists atoms until the next keyword.
+            while (count != 0 && !in.atEnd()) {
+                size_t mark = in.pos;
+                std::vector<std::string> a = tokens(in.next());
+                if (a.size() < 4 || !isNumber(a[1])) {
+                    in.pos = mark;
+                    break;
+                }
+                int z = atomicNumber(a[0]);
+                CubeAtom atom{z, static_cast<double>(z),
+                              {std::stod(a[1]) / bohrInAngstrom, std::stod(a[2]) / bohrInAngstrom,
+                               std::stod(a[3]) / bohrInAngstrom}};
+                h.atoms.push_back(atom);
+                if (count > 0)
+                    --count;
+            }
+        }
+        else if (key.rfind("BEGIN_BLOCK_DATAGRID", 0) == 0) {
+            h.comment1 = in.next();
+        }
+        else if (key.rfind("BEGIN_DATAGRID_3D", 0) == 0 || key.rfind("DATAGRID_3D", 0) == 0) {
+            if (h.comment1.empty())
+                h.comment1 = key;
+            int n[3];
+            double origin[3], span[3][3];
+            std::istringstream counts(in.next());
+            if (!(counts >> n[0] >> n[1] >> n[2]))
+                throw std::runtime_error("Error reading grid dimensions in " + filename);
+            std::istringstream o(in.next());
+            if (!(o >> origin[0] >> origin[1] >> origin[2]))
+                throw std::runtime_error("Error reading the grid origin in " + filename);
+            for (int i = 0; i < 3; ++i) {
+                std::istringstream s(in.next());
+                if (!(s >> span[i][0] >> span[i][1] >> span[i][2]))
+                    throw std::runtime_error("Error reading spanning vector " + std::to_string(i));
+            }
+            const char *p = file.data() + in.pos;
+            std::vector<double> general = readFortranOrderGrid(p, file.end(), n, "XSF");
+
+            // A general grid has n - 1 intervals along each axis.
+            int divisions[3] = {std::max(n[0] - 1, 1), std::max(n[1] - 1, 1), std::max(n[2] - 1, 1)};
+            int dims[3] = {n[0], n[1], n[2]};
+            if (periodic) {
+                for (int i = 0; i < 3; ++i)
+                    dims[i] = std::max(n[i] - 1, 1);
+                cube.values.reserve(static_cast<size_t>(dims[0]) * dims[1] * dims[2]);
+                for (int x = 0; x < dims[0]; ++x)
+                    for (int y = 0; y < dims[1]; ++y) {
+                        const double *row = general.data() + (static_cast<size_t>(x) * n[1] + y) * n[2];
+                        cube.values.insert(cube.values.end(), row, row + dims[2]);
+                    }
+            }
+            else {
+                cube.values = std::move(general);
+            }
+            setGridGeometry(h, origin, span, dims, divisions);
+            haveGrid = true;
+        }
+    }
+    if (!haveGrid)
+        throw std::runtime_error("Error: No DATAGRID_3D block found in " + filename);
+    h.numAtoms = static_cast<int>(h.atoms.size());
+
+    // XSF lengths are in Å, and the grid values are taken to be densities per Å^3
+    // (electrons/Å^3, as written by VESTA and Quantum ESPRESSO's pp.x); like the geometry
+    // they are converted to bohr units.
+    const double factor = std::pow(bohrInAngstrom, 3.0);
+    for (double &v : cube.values)
+        v *= factor;
+    return cube;
+}
+
+VolumetricFormat detectVolumetricFormat(const std::string &filename) {
+    if (isCubeBinaryFile(filename))
+        return VolumetricFormat::CubeBinary;
+
+    // Sniff the first lines: XSF starts with a keyword; CHGCAR has a lone scale factor
+    // on line 2 and three lattice components on line 3.
+    MappedFile file(filename);
+    LineReader in{file.data(), file.size(), 0};
+    std::vector<std::string> lines;
+    while (lines.size() < 3 && !in.atEnd()) {
+        std::string line = in.next();
+        if (lines.empty() && !line.empty() && line[0] == '#')
+            continue;
+        lines.push_back(line);
+    }
+    if (!lines.empty()) {
+        std::vector<std::string> first = tokens(lines[0]);
+        static const char *const xsfKeywords[] = {"CRYSTAL", "SLAB", "POLYMER", "MOLECULE", "ATOMS",
+                                                  "PRIMVEC", "ANIMSTEPS", "BEGIN_BLOCK_DATAGRID_3D"};
+        if (first.size() == 1)
+            for (const char *k : xsfKeywords)
+                if (first[0] == k)
+                    return VolumetricFormat::Xsf;
+    }
+    if (lines.size() == 3) {
+        std::vector<std::string> scale = tokens(lines[1]), a = tokens(lines[2]);
+        if (scale.size() == 1 && isNumber(scale[0]) && a.size() == 3 && isNumber(a[0]) && isNumber(a[1]) &&
+            isNumber(a[2]))
+            return VolumetricFormat::Chgcar;
+    }
+    return VolumetricFormat::Cube;
+}
+
+CubeData loadCube(const std::string &filename, bool allowTruncated) {
+    const VolumetricFormat format = detectVolumetricFormat(filename);
+    if (format == VolumetricFormat::CubeBinary)
+        return readCubeBinary(filename);
+    if (format == VolumetricFormat::Xsf)
+        return readXsfFile(filename);
+    if (format == VolumetricFormat::Chgcar)
+        return readChgcarFile(filename);
+    return readCubeFile(filename, allowTruncated);
+}
@@ -0,0 +1,110 @@
+/*
+ * CubeIsoFinder
+ * File: threshold_contract_test.cpp
+ *
+ * Description:
+ *   Checks the threshold contract: isovalues and percentages are bit-identical for any
+ *   number of worker threads, tied grid points are enclosed, and an orbital tie between
+ *   +psi and -psi resolves to the positive amplitude.
+ *
+ * Author: Markus G. S. Weiss
+ * Created: 2025-02-13
+ *
+ * License: GNU GPL v3.0
+ *   See LICENSE file in the project root for full license information.
+ */
+
+#include "cube_parser.hpp"
+#include "parallel.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+bool sameBits(double a, double b) {
+    return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// A grid of many reduction blocks with repeated levels, so that both the block sums and
+// the tie handling take part. Values are on a coarse lattice (multiples of 1/64).
+std::vector<double> syntheticGrid(size_t count, bool signedValues) {
+    std::vector<double> values(count);
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (auto &v : values) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        const double level = static_cast<double>((state >> 33) % 512) / 64.0;
+        v = signedValues && ((state >> 20) & 1) ? -level : level;
+    }
+    return values;
+}
+
+// Every result for -j 1 is compared bit for bit with the results for -j 3 and -j 8.
+void checkThreadIndependence() {
+    const std::vector<double> density = syntheticGrid(300007, false);
+    const std::vector<double> orbital = syntheticGrid(300007, true);
+    const double percents[] = {10.0, 37.3, 50.0, 90.0, 99.9};
+    const unsigned threadCounts[] = {1, 3, 8};
+
+    std::vector<double> reference;
+    for (unsigned threads : threadCounts) {
+        setWorkerCount(threads);
+        std::vector<double> results;
+        for (double p : percents) {
+            for (bool interpolate : {false, true}) {
+                results.push_back(computeIsovalueFromPercentage_Density(density, p, true, interpolate));
+                results.push_back(computeIsovalueFromPercentage_Orbital(orbital, p, true, interpolate));
+            }
+            results.push_back(computePercentageFromIsovalue_Density(density, p / 20.0, true));
+            results.push_back(computePercentageFromIsovalue_Orbital(orbital, p / 20.0, true));
+        }
+        if (reference.empty()) {
+            reference = results;
+            continue;
+        }
+        for (size_t i = 0; i < results.size(); ++i)
+            check(sameBits(results[i], reference[i]),
+                  "result " + std::to_string(i) + " with -j " + std::to_string(threads) + " differs from -j 1");
+    }
+    setWorkerCount(0);
+}
+
+void checkTies() {
+    // Density: the target (50% of 11) is reached inside the level 2, and the whole level
+    // is enclosed.
+    const std::vector<double> density = {1.0, 2.0, 4.0, 2.0, 2.0};
+    check(computeIsovalueFromPercentage_Density(density, 50.0, true) == 2.0, "density tie isovalue");
+    check(std::abs(computePercentageFromIsovalue_Density(density, 2.0, true) - 100.0 * 10.0 / 11.0) < 1e-12,
+          "density tie enclosed percentage");
+
+    // Orbital: +0.5 and -0.5 form one level of psi^2; the positive amplitude is reported
+    // and both points are enclosed.
+    const std::vector<double> orbital = {0.1, -0.5, 0.5};
+    check(computeIsovalueFromPercentage_Orbital(orbital, 30.0, true) == 0.5, "orbital +-psi tie isovalue");
+    check(computeIsovalueFromPercentage_Orbital({0.1, 0.5, -0.5}, 30.0, true) == 0.5,
+          "orbital +-psi tie isovalue (other order)");
+    check(std::abs(computePercentageFromIsovalue_Orbital(orbital, 0.5, true) - 100.0 * 0.5 / 0.51) < 1e-12,
+          "orbital +-psi tie enclosed percentage");
+}
+
+} // namespace
+
+int main() {
+    checkThreadIndependence();
+    checkTies();
+    if (failures == 0)
+        std::cout << "All threshold contract checks passed.\n";
+    return failures == 0 ? 0 : 1;
+}